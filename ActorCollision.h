@@ -0,0 +1,216 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <iostream>
+#include <glm.hpp>
+
+#include "ActorWorld.h"
+#include "Seabed.h"
+#include "ThreadPool.h"
+#include "Benchmark.h"
+
+// Collision between the actors with a behaviour, as circles of Behaviour::radius on the xz plane.
+// The broadphase is a uniform grid over the actors, rebuilt every step with a counting sort like the
+// fish school's, with cells at least one diameter wide so that overlapping actors are in the same or
+// adjacent cells. Each actor then moves itself out of STIFFNESS of its overlaps, which spreads a
+// crowd out over a few steps, and down any seabed slope steeper than MAX_SLOPE, which keeps it off
+// the rocks and the volcano. The work per actor only depends on the crowd's density.
+class ActorCollision {
+
+private:
+    ActorCollision() {}
+
+    ActorCollision(const ActorCollision&) = delete;
+    ActorCollision& operator=(const ActorCollision&) = delete;
+public:
+
+    static ActorCollision* Instance()
+    {
+        static ActorCollision* instance = new ActorCollision();
+        return instance;
+    }
+
+    const float STIFFNESS = 0.5f;               // share of an overlap resolved per step, by each of the two
+    const float MAX_SLOPE = 1.0f;               // walkable seabed, 45 degrees
+    const float SLOPE_PUSH = 8.0f;              // units per second per unit of slope beyond MAX_SLOPE
+    const int CELLS_PER_ACTOR = 4;              // at most, cells grow for crowds spread far apart
+
+    // actors in grid order, positions point into the transform arrays of their archetypes
+    std::vector<glm::vec3*> positions;
+    std::vector<float> posX, posZ, radius;
+    std::vector<glm::vec3*> sortedPositions;
+    std::vector<float> sortedX, sortedZ, sortedRadius;
+    std::vector<int> actorCell;
+    std::vector<int> cellStart;                 // actors of cell c are [cellStart[c], cellStart[c + 1])
+    std::vector<int> cellCursor;
+    glm::vec2 gridOrigin = glm::vec2(0.0f);
+    float cellSize = 1.0f;
+    int cellsX = 0, cellsZ = 0;
+
+    // once per frame after the actors moved, before the ground following
+    void update(ActorWorld& world, float dt) {
+        gather(world);
+        int count = static_cast<int>(positions.size());
+        if (count == 0) return;
+        buildGrid();
+        const Seabed* ground = Seabed::Instance();
+        bool sloped = ground->ready();
+        ThreadPool::Instance()->parallelFor(count, [&](int begin, int end, int) {
+            for (int i = begin; i < end; ++i) {
+                glm::vec2 push = separation(i);
+                if (sloped) {
+                    glm::vec2 slope = ground->slope(sortedX[i], sortedZ[i]);
+                    float steepness = std::sqrt(glm::dot(slope, slope));
+                    if (steepness > MAX_SLOPE)
+                        push -= slope / steepness * (steepness - MAX_SLOPE) * SLOPE_PUSH * dt;
+                }
+                sortedPositions[i]->x += push.x;
+                sortedPositions[i]->z += push.y;
+            }
+        });
+    }
+
+    void gather(ActorWorld& world) {
+        positions.clear();
+        radius.clear();
+        world.each(COMPONENT_TRANSFORM | COMPONENT_BEHAVIOUR, [&](Archetype& a) {
+            for (size_t i = 0; i < a.size(); ++i) {
+                positions.push_back(&a.transforms[i].position);
+                radius.push_back(a.behaviours[i].radius);
+            }
+        });
+        posX.resize(positions.size());
+        posZ.resize(positions.size());
+        for (size_t i = 0; i < positions.size(); ++i) {
+            posX[i] = positions[i]->x;
+            posZ[i] = positions[i]->z;
+        }
+    }
+
+    // grid over the bounds of the actors, then a counting sort of them by cell into the sorted arrays
+    void buildGrid() {
+        int count = static_cast<int>(positions.size());
+        glm::vec2 boundsMin(posX[0], posZ[0]), boundsMax = boundsMin;
+        float maxRadius = 0.0f;
+        for (int i = 0; i < count; ++i) {
+            boundsMin = glm::min(boundsMin, glm::vec2(posX[i], posZ[i]));
+            boundsMax = glm::max(boundsMax, glm::vec2(posX[i], posZ[i]));
+            maxRadius = std::max(maxRadius, radius[i]);
+        }
+        glm::vec2 extent = boundsMax - boundsMin;
+        // smallest size with (extent.x / size + 1) * (extent.y / size + 1) <= CELLS_PER_ACTOR * count,
+        // which bounds thin strips of actors too
+        float sum = extent.x + extent.y, cellsLimit = float(CELLS_PER_ACTOR * count - 1);
+        float spreadSize = (sum + std::sqrt(sum * sum + 4.0f * cellsLimit * extent.x * extent.y)) / (2.0f * cellsLimit);
+        cellSize = std::max({ 2.0f * maxRadius, spreadSize, 1e-3f });
+        cellsX = int(extent.x / cellSize) + 1;
+        cellsZ = int(extent.y / cellSize) + 1;
+        gridOrigin = boundsMin;
+
+        actorCell.resize(count);
+        for (int i = 0; i < count; ++i)
+            actorCell[i] = cellCoord(posZ[i], gridOrigin.y, cellsZ) * cellsX + cellCoord(posX[i], gridOrigin.x, cellsX);
+        cellStart.assign(cellsX * cellsZ + 1, 0);
+        for (int i = 0; i < count; ++i)
+            ++cellStart[actorCell[i] + 1];
+        for (size_t c = 1; c < cellStart.size(); ++c)
+            cellStart[c] += cellStart[c - 1];
+        cellCursor.assign(cellStart.begin(), cellStart.end() - 1);
+
+        sortedPositions.resize(count);
+        sortedX.resize(count);
+        sortedZ.resize(count);
+        sortedRadius.resize(count);
+        for (int i = 0; i < count; ++i) {
+            int slot = cellCursor[actorCell[i]]++;
+            sortedPositions[slot] = positions[i];
+            sortedX[slot] = posX[i];
+            sortedZ[slot] = posZ[i];
+            sortedRadius[slot] = radius[i];
+        }
+    }
+
+    int cellCoord(float coord, float origin, int cells) const {
+        return glm::clamp(int((coord - origin) / cellSize), 0, cells - 1);
+    }
+
+    // how far sorted actor i moves out of the actors that overlap it in its own and the adjacent cells
+    glm::vec2 separation(int i) const {
+        glm::vec2 push(0.0f);
+        int cx = cellCoord(sortedX[i], gridOrigin.x, cellsX);
+        int cz = cellCoord(sortedZ[i], gridOrigin.y, cellsZ);
+        for (int z = std::max(cz - 1, 0); z <= std::min(cz + 1, cellsZ - 1); ++z) {
+            // the three cells of a row are one contiguous range
+            int begin = cellStart[z * cellsX + std::max(cx - 1, 0)];
+            int end = cellStart[z * cellsX + std::min(cx + 1, cellsX - 1) + 1];
+            for (int j = begin; j < end; ++j) {
+                float dx = sortedX[i] - sortedX[j], dz = sortedZ[i] - sortedZ[j];
+                float minimum = sortedRadius[i] + sortedRadius[j];
+                float distanceSq = dx * dx + dz * dz;
+                if (j == i || distanceSq >= minimum * minimum) continue;
+                float distance = std::sqrt(distanceSq);
+                // actors on the same spot part along the order they were sorted in
+                glm::vec2 away = distance > 1e-5f ? glm::vec2(dx, dz) / distance : glm::vec2(i < j ? -1.0f : 1.0f, 0.0f);
+                push += away * (minimum - distance) * STIFFNESS * 0.5f;
+            }
+        }
+        return push;
+    }
+};
+
+// Crowds of 1k to 20k actors at the same density on flat ground, --benchmark bakes no seabed. The
+// time per actor should stay flat as the crowd grows, testing every pair is timed for the smaller
+// crowds for comparison.
+void benchmarkActorCollision() {
+    const unsigned int WALKER = COMPONENT_TRANSFORM | COMPONENT_BEHAVIOUR;
+    const float SPACING = 5.0f;                 // average distance between neighbours, radius 3 overlaps
+    const float dt = 1.0f / 60.0f;
+    std::mt19937 random(9);
+    std::uniform_real_distribution<float> unit(-0.5f, 0.5f);
+
+    ActorWorld* world = ActorWorld::Instance();
+    ActorCollision* collision = ActorCollision::Instance();
+    std::cout << "Actor collision, " << ThreadPool::Instance()->ThreadCount() << " threads" << std::endl;
+    for (int count : { 1000, 2500, 5000, 10000, 20000 }) {
+        std::vector<Entity> entities;
+        float side = SPACING * std::sqrt(float(count));
+        for (int i = 0; i < count; ++i) {
+            Entity entity = world->create(WALKER);
+            world->archetypeOf(entity).transforms[world->rowOf(entity)].position = glm::vec3(side * unit(random), 0.0f, side * unit(random));
+            entities.push_back(entity);
+        }
+        std::cout << " " << count << " actors" << std::endl;
+        // every run starts from the spawn positions, otherwise the later runs find the overlaps
+        // already pushed apart, restoring them costs a copy of 12 bytes per actor
+        collision->gather(*world);
+        std::vector<glm::vec3*> spawned = collision->positions;
+        std::vector<glm::vec3> spawnPositions;
+        for (glm::vec3* position : spawned) spawnPositions.push_back(*position);
+        auto respawn = [&]() { for (size_t i = 0; i < spawned.size(); ++i) *spawned[i] = spawnPositions[i]; };
+        double grid = benchmark::Measure("uniform grid", 20, [&]() { respawn(); collision->update(*world, dt); });
+        std::cout << "  " << grid * 1e6 / count << " ns per actor" << std::endl;
+
+        if (count <= 2500) {
+            benchmark::Measure("every pair", 5, [&]() {
+                respawn();
+                collision->gather(*world);
+                for (int i = 0; i < count; ++i) {
+                    glm::vec2 push(0.0f);
+                    for (int j = 0; j < count; ++j) {
+                        float dx = collision->posX[i] - collision->posX[j], dz = collision->posZ[i] - collision->posZ[j];
+                        float minimum = collision->radius[i] + collision->radius[j];
+                        float distanceSq = dx * dx + dz * dz;
+                        if (j == i || distanceSq >= minimum * minimum) continue;
+                        float distance = std::sqrt(distanceSq);
+                        if (distance > 1e-5f) push += glm::vec2(dx, dz) / distance * (minimum - distance) * collision->STIFFNESS * 0.5f;
+                    }
+                    collision->positions[i]->x += push.x;
+                    collision->positions[i]->z += push.y;
+                }
+            });
+        }
+        for (Entity entity : entities) world->destroy(entity);
+    }
+}
@@ -0,0 +1,474 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <random>
+#include <utility>
+#include <iostream>
+#include <GL/glew.h>
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+
+#include "ModelStructure.h"
+#include "InstanceTransform.h"
+#include "FishRenderer.h"
+#include "ThreadPool.h"
+#include "Heightmap.h"
+#include "Seabed.h"
+#include "Benchmark.h"
+
+// Entities index the location table of ActorWorld, mesh handles its mesh library
+using Entity = uint32_t;
+using MeshHandle = uint32_t;
+const Entity NO_ENTITY = 0xFFFFFFFF;
+
+// Components an entity can have, an archetype is the set of them as a bit mask
+enum Component : unsigned int {
+    COMPONENT_TRANSFORM = 1 << 0,       // position and rotation, turned into the model matrix by updateMatrices
+    COMPONENT_VELOCITY = 1 << 1,
+    COMPONENT_BEHAVIOUR = 1 << 2,       // runs away from the camera when clicked
+    COMPONENT_ORBIT = 1 << 3,           // circles the volcano, writes its model matrix itself
+    COMPONENT_SCHOOL = 1 << 4,          // boid of FishSchool, which keeps the state and writes the model matrix of its row
+    COMPONENT_RENDER_MESH = 1 << 5,
+    COMPONENT_GROUNDED = 1 << 6,        // walks on the seabed, tilted to its slope
+};
+
+struct Transform {
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::vec3 rotation = glm::vec3(0.0f);   // radians around the local x, then y, then z axis
+};
+
+struct Velocity {
+    glm::vec3 linear = glm::vec3(0.0f);     // units per second along each axis
+};
+
+struct Behaviour {
+    float radius = 3.0f;                    // collision circle around the position, see ActorCollision
+    bool runAway = false;
+    float runAwayTime = 0.0f;               // seconds left
+
+    void StartRun() {
+        runAway = true;
+        runAwayTime = RUNAWAYTIME;
+    }
+};
+
+// the orbit component is FishInstance from ModelStructure.h
+
+struct Grounded {
+    float offset = 0.0f;                    // height of the position above the seabed
+    glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f);  // seabed normal under the position
+};
+
+struct RenderMesh {
+    MeshHandle mesh = 0;
+};
+
+inline float NormalizeAngle(float angle) {
+    while (angle > glm::pi<float>()) angle -= glm::two_pi<float>();
+    while (angle < -glm::pi<float>()) angle += glm::two_pi<float>();
+    return angle;
+}
+
+// rotation around the local axes X, Y, Z, then the translation
+inline glm::mat4 ModelMatrix(const Transform& transform) {
+    glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), transform.rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
+    rotation = glm::rotate(rotation, transform.rotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
+    rotation = glm::rotate(rotation, transform.rotation.z, glm::vec3(0.0f, 0.0f, 1.0f));
+    return glm::translate(glm::mat4(1.0f), transform.position) * rotation;
+}
+
+// the same, with the up axis tilted onto the normal of the ground below
+inline glm::mat4 ModelMatrix(const Transform& transform, const glm::vec3& groundNormal) {
+    glm::vec3 axis(groundNormal.z, 0.0f, -groundNormal.x);
+    float sine = std::sqrt(glm::dot(axis, axis));
+    if (sine < 1e-4f) return ModelMatrix(transform);
+    glm::mat4 tilt = glm::rotate(glm::mat4(1.0f), std::atan2(sine, groundNormal.y), axis / sine);
+    Transform rotation = transform;
+    rotation.position = glm::vec3(0.0f);
+    return glm::translate(glm::mat4(1.0f), transform.position) * tilt * ModelMatrix(rotation);
+}
+
+// All entities with the same components, one array per component, row i of every array belongs to
+// entities[i]. Only the arrays of the components in mask are filled. Every archetype with a render
+// mesh also keeps the model matrix of each row in matrices, contiguous so that it goes to the
+// instance upload as it is.
+struct Archetype {
+    unsigned int mask = 0;
+    std::vector<Entity> entities;
+    std::vector<Transform> transforms;
+    std::vector<Velocity> velocities;
+    std::vector<Behaviour> behaviours;
+    std::vector<FishInstance> orbits;
+    std::vector<RenderMesh> meshes;
+    std::vector<Grounded> grounded;
+    std::vector<glm::mat4> matrices;
+
+    size_t size() const { return entities.size(); }
+    bool has(unsigned int components) const { return (mask & components) == components; }
+
+    size_t add(Entity entity) {
+        entities.push_back(entity);
+        if (mask & COMPONENT_TRANSFORM) transforms.emplace_back();
+        if (mask & COMPONENT_VELOCITY) velocities.emplace_back();
+        if (mask & COMPONENT_BEHAVIOUR) behaviours.emplace_back();
+        if (mask & COMPONENT_ORBIT) orbits.emplace_back();
+        if (mask & COMPONENT_GROUNDED) grounded.emplace_back();
+        if (mask & COMPONENT_RENDER_MESH) {
+            meshes.emplace_back();
+            matrices.emplace_back(1.0f);
+        }
+        return entities.size() - 1;
+    }
+
+    // the last row moves into row
+    void remove(size_t row) {
+        auto swapPop = [row](auto& column) {
+            if (column.empty()) return;
+            column[row] = column.back();
+            column.pop_back();
+        };
+        swapPop(entities);
+        swapPop(transforms);
+        swapPop(velocities);
+        swapPop(behaviours);
+        swapPop(orbits);
+        swapPop(meshes);
+        swapPop(grounded);
+        swapPop(matrices);
+    }
+
+    void clear() {
+        entities.clear(); transforms.clear(); velocities.clear(); behaviours.clear();
+        orbits.clear(); meshes.clear(); grounded.clear(); matrices.clear();
+    }
+};
+
+// A mesh shared by every entity that references it by handle, drawn instanced
+struct MeshAsset {
+    ModelData model;
+    float radius = 0.0f;                    // bounding sphere around the model origin
+    bool batched = true;                    // false when a renderer of its own reads the archetype matrices
+    std::vector<glm::mat4> batch;           // model matrices of all its entities, gathered every frame
+    std::vector<glm::mat4> visible;         // upload staging, culled
+    std::vector<CompactTransform> packed;
+    size_t visibleCount = 0;
+};
+
+// Entity component storage for the crabs, the fish and the actors to come. Entities with the same
+// components share an archetype, so a system walks the contiguous arrays of the components it needs
+// in the archetypes that have them and never touches the rest. Entities refer to meshes by handle,
+// every mesh is loaded once and all its entities are gathered into one instanced draw. Archetypes
+// live in a deque so references to them survive the creation of new ones.
+class ActorWorld {
+
+private:
+    ActorWorld() {}
+
+    ActorWorld(const ActorWorld&) = delete;
+    ActorWorld& operator=(const ActorWorld&) = delete;
+public:
+
+    static ActorWorld* Instance()
+    {
+        static ActorWorld* instance = new ActorWorld();
+        return instance;
+    }
+
+    struct Location {
+        int archetype = -1;                 // -1 for a destroyed entity
+        size_t row = 0;
+    };
+
+    std::vector<MeshAsset> meshes;
+    std::deque<Archetype> archetypes;
+    std::vector<Location> locations;        // by entity
+    std::vector<Entity> freeEntities;
+
+    MeshHandle addMesh(ModelData model, bool batched = true) {
+        MeshAsset asset;
+        asset.model = std::move(model);
+        asset.batched = batched;
+        std::vector<const ModelData*> parts = { &asset.model };
+        while (!parts.empty()) {
+            const ModelData* part = parts.back();
+            parts.pop_back();
+            for (const glm::vec3& vertex : part->mVertices)
+                asset.radius = std::max(asset.radius, glm::length(vertex));
+            for (const ModelData& child : part->mChildMeshes) parts.push_back(&child);
+        }
+        meshes.push_back(std::move(asset));
+        return static_cast<MeshHandle>(meshes.size() - 1);
+    }
+
+    // per instance CompactTransform attributes on the VAO of mesh, after its vertex buffers are set up
+    void enableInstancing(MeshHandle mesh) {
+        ModelData& model = meshes[mesh].model;
+        glBindVertexArray(model.mVao);
+        glGenBuffers(1, &model.instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, model.instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STREAM_DRAW);
+        for (int i = 0; i < 2; i++) {
+            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(CompactTransform), (void*)(i * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(3 + i);
+            glVertexAttribDivisor(3 + i, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    Archetype& archetype(unsigned int mask) {
+        return archetypes[archetypeIndex(mask)];
+    }
+
+    Entity create(unsigned int mask) {
+        Entity entity;
+        if (!freeEntities.empty()) {
+            entity = freeEntities.back();
+            freeEntities.pop_back();
+        } else {
+            entity = static_cast<Entity>(locations.size());
+            locations.emplace_back();
+        }
+        int index = archetypeIndex(mask);
+        locations[entity] = { index, archetypes[index].add(entity) };
+        return entity;
+    }
+
+    void destroy(Entity entity) {
+        Location& location = locations[entity];
+        Archetype& owner = archetypes[location.archetype];
+        owner.remove(location.row);
+        if (location.row < owner.size()) locations[owner.entities[location.row]].row = location.row;
+        location.archetype = -1;
+        freeEntities.push_back(entity);
+    }
+
+    // every entity of the archetypes that have all of components
+    void destroyAll(unsigned int components) {
+        for (Archetype& a : archetypes) {
+            if (!a.has(components)) continue;
+            for (Entity entity : a.entities) {
+                locations[entity].archetype = -1;
+                freeEntities.push_back(entity);
+            }
+            a.clear();
+        }
+    }
+
+    Archetype& archetypeOf(Entity entity) { return archetypes[locations[entity].archetype]; }
+    size_t rowOf(Entity entity) const { return locations[entity].row; }
+
+    // fn(archetype) for every non-empty archetype that has all of components
+    template <class Fn>
+    void each(unsigned int components, Fn fn) {
+        for (Archetype& a : archetypes)
+            if (a.has(components) && a.size() > 0) fn(a);
+    }
+
+    size_t count(unsigned int components) {
+        size_t total = 0;
+        each(components, [&](Archetype& a) { total += a.size(); });
+        return total;
+    }
+
+    // Run away system: an entity that was clicked moves away from the camera and turns its back to
+    // it during the first half of its run
+    void updateRunAway(float dt, const glm::vec3& from) {
+        each(COMPONENT_TRANSFORM | COMPONENT_VELOCITY | COMPONENT_BEHAVIOUR, [&](Archetype& a) {
+            ThreadPool::Instance()->parallelFor(static_cast<int>(a.size()), [&](int begin, int end, int) {
+                for (int i = begin; i < end; ++i) {
+                    Behaviour& behaviour = a.behaviours[i];
+                    if (!behaviour.runAway) continue;
+                    Transform& transform = a.transforms[i];
+                    glm::vec3 direction = glm::normalize(transform.position - from);
+                    transform.position += direction * a.velocities[i].linear * dt;
+
+                    // yaw around the local y axis, smoothly towards facing away
+                    float targetYaw = NormalizeAngle(std::atan2(direction.x, direction.z));
+                    if (behaviour.runAwayTime >= RUNAWAYTIME / 2.0f)
+                        transform.rotation.y += NormalizeAngle(targetYaw - transform.rotation.y) * (RUNAWAYTIME - behaviour.runAwayTime) / RUNAWAYTIME * 2.0f;
+
+                    if (behaviour.runAwayTime <= 0.0f) behaviour.runAway = false;
+                    behaviour.runAwayTime -= dt;
+                }
+            });
+        });
+    }
+
+    // Ground following system: keeps each entity at its offset above the ground and records the
+    // normal there for updateMatrices
+    void updateGrounding() {
+        const Seabed* ground = Seabed::Instance();
+        if (!ground->ready()) return;
+        each(COMPONENT_TRANSFORM | COMPONENT_GROUNDED, [&](Archetype& a) {
+            ThreadPool::Instance()->parallelFor(static_cast<int>(a.size()), [&](int begin, int end, int) {
+                for (int i = begin; i < end; ++i) {
+                    glm::vec3& position = a.transforms[i].position;
+                    position.y = ground->height(position.x, position.z) + a.grounded[i].offset;
+                    a.grounded[i].normal = ground->normal(position.x, position.z);
+                }
+            });
+        });
+    }
+
+    // Model matrix system, with the phase of each entity in the free element like the fish
+    // (FishRenderer::setPhase) for the skinned meshes
+    void updateMatrices() {
+        each(COMPONENT_TRANSFORM | COMPONENT_RENDER_MESH, [&](Archetype& a) {
+            bool tilted = a.has(COMPONENT_GROUNDED);
+            ThreadPool::Instance()->parallelFor(static_cast<int>(a.size()), [&](int begin, int end, int) {
+                for (int i = begin; i < end; ++i) {
+                    a.matrices[i] = tilted ? ModelMatrix(a.transforms[i], a.grounded[i].normal) : ModelMatrix(a.transforms[i]);
+                    FishRenderer::setPhase(a.matrices[i], FishPhase(static_cast<int>(a.entities[i])));
+                }
+            });
+        });
+    }
+
+    // the model matrices of every batched mesh from all archetypes into its batch
+    void gatherBatches() {
+        for (MeshAsset& mesh : meshes) mesh.batch.clear();
+        each(COMPONENT_RENDER_MESH, [&](Archetype& a) {
+            for (size_t i = 0; i < a.size(); ++i) {
+                MeshAsset& mesh = meshes[a.meshes[i].mesh];
+                if (mesh.batched) mesh.batch.push_back(a.matrices[i]);
+            }
+        });
+    }
+
+    // one instanced draw of the batch of mesh inside the frustum, with the shader of renderModels
+    void drawBatch(MeshHandle handle, GLuint shaderProgram, const glm::mat4& viewProjection, Type type) {
+        MeshAsset& mesh = meshes[handle];
+        if (mesh.batch.empty()) return;
+        mesh.visible.resize(mesh.batch.size());
+        mesh.visibleCount = cullInstances(Frustum::FromMatrix(viewProjection), mesh.batch.data(), mesh.batch.size(), mesh.radius, mesh.visible.data());
+        if (mesh.visibleCount == 0) return;
+        mesh.packed.resize(mesh.visibleCount);
+        packTransforms(mesh.visible.data(), mesh.packed.data(), mesh.visibleCount);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.model.instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, mesh.packed.size() * sizeof(CompactTransform), mesh.packed.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, mesh.model.mTextureId);
+        glUniform1i(glGetUniformLocation(shaderProgram, "texture1"), 0);
+        glUniform1i(glGetUniformLocation(shaderProgram, "type"), int(type));
+        glUniform1i(glGetUniformLocation(shaderProgram, "instanced"), true);
+        glBindVertexArray(mesh.model.mVao);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, static_cast<GLsizei>(mesh.model.mPointCount), static_cast<GLsizei>(mesh.visibleCount));
+        glBindVertexArray(0);
+        glUniform1i(glGetUniformLocation(shaderProgram, "instanced"), false);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+private:
+    int archetypeIndex(unsigned int mask) {
+        for (size_t i = 0; i < archetypes.size(); ++i)
+            if (archetypes[i].mask == mask) return static_cast<int>(i);
+        archetypes.emplace_back();
+        archetypes.back().mask = mask;
+        return static_cast<int>(archetypes.size() - 1);
+    }
+};
+
+// The run away and model matrix systems and the gathering by mesh for 10k and 50k crabs over five
+// meshes, every tenth running, against the same update over an array of structs that each carry
+// their own ModelData, as the crabs used to.
+void benchmarkActorWorld() {
+    struct OwnedCrab {
+        ModelData model;
+        Transform transform;
+        Velocity velocity;
+        Behaviour behaviour;
+        glm::mat4 matrix;
+    };
+    const int MESHES = 5;
+    const unsigned int CRAB = COMPONENT_TRANSFORM | COMPONENT_VELOCITY | COMPONENT_BEHAVIOUR | COMPONENT_RENDER_MESH;
+    const glm::vec3 camera(0.0f, 48.0f, 216.0f);
+    const float dt = 1.0f / 60.0f;
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    ActorWorld* world = ActorWorld::Instance();
+    MeshHandle firstMesh = static_cast<MeshHandle>(world->meshes.size());
+    for (int m = 0; m < MESHES; ++m) world->addMesh(ModelData());
+    std::cout << "Actor world, " << ThreadPool::Instance()->ThreadCount() << " threads" << std::endl;
+    for (int count : { 10000, 50000 }) {
+        std::vector<OwnedCrab> owned(count);
+        std::vector<Entity> entities;
+        for (int i = 0; i < count; ++i) {
+            Transform transform;
+            transform.position = glm::vec3(100.0f * unit(random), 10.0f, 100.0f * unit(random));
+            transform.rotation.y = glm::pi<float>() * unit(random);
+            Entity entity = world->create(CRAB);
+            Archetype& a = world->archetypeOf(entity);
+            size_t row = world->rowOf(entity);
+            a.transforms[row] = transform;
+            a.velocities[row].linear = glm::vec3(5.0f, 0.0f, 5.0f);
+            a.meshes[row].mesh = firstMesh + i % MESHES;
+            if (i % 10 == 0) a.behaviours[row].StartRun();
+            entities.push_back(entity);
+
+            owned[i].transform = transform;
+            owned[i].velocity = a.velocities[row];
+            owned[i].behaviour = a.behaviours[row];
+        }
+
+        size_t rowBytes = sizeof(Entity) + sizeof(Transform) + sizeof(Velocity) + sizeof(Behaviour) + sizeof(RenderMesh) + sizeof(glm::mat4);
+        std::cout << " " << count << " crabs, " << sizeof(OwnedCrab) << " bytes per crab with its own model and a draw each, "
+            << rowBytes << " bytes per archetype row and " << MESHES << " instanced draws" << std::endl;
+        benchmark::Measure("array of structs, run away", 20, [&]() {
+            for (OwnedCrab& crab : owned) {
+                if (!crab.behaviour.runAway) continue;
+                glm::vec3 direction = glm::normalize(crab.transform.position - camera);
+                crab.transform.position += direction * crab.velocity.linear * dt;
+                float targetYaw = NormalizeAngle(std::atan2(direction.x, direction.z));
+                if (crab.behaviour.runAwayTime >= RUNAWAYTIME / 2.0f)
+                    crab.transform.rotation.y += NormalizeAngle(targetYaw - crab.transform.rotation.y) * (RUNAWAYTIME - crab.behaviour.runAwayTime) / RUNAWAYTIME * 2.0f;
+                if (crab.behaviour.runAwayTime <= 0.0f) crab.behaviour.runAway = false;
+                crab.behaviour.runAwayTime -= dt;
+            }
+        });
+        benchmark::Measure("archetypes, run away", 20, [&]() { world->updateRunAway(dt, camera); });
+        benchmark::Measure("array of structs, model matrices", 20, [&]() {
+            for (OwnedCrab& crab : owned) {
+                crab.matrix = ModelMatrix(crab.transform);
+                FishRenderer::setPhase(crab.matrix, FishPhase(static_cast<int>(&crab - owned.data())));
+            }
+        });
+        benchmark::Measure("archetypes, model matrices", 20, [&]() { world->updateMatrices(); });
+        benchmark::Measure("archetypes, gather by mesh", 20, [&]() { world->gatherBatches(); });
+        for (Entity entity : entities) world->destroy(entity);
+    }
+
+    // walkers on rolling dunes, kept on the ground and tilted to it, the dunes stand in for the
+    // seabed, which --benchmark does not bake, and are swapped out again at the end
+    Heightmap dunes;
+    dunes.Resize(glm::vec2(-100.0f), 200.0f / 255.0f, 256, 256, 0.0f);
+    for (int z = 0; z < dunes.resolutionZ; ++z)
+        for (int x = 0; x < dunes.resolutionX; ++x)
+            dunes.at(x, z) = 4.0f * std::sin(0.1f * x) * std::cos(0.07f * z);
+    dunes.BakeSlopes();
+    std::swap(Seabed::Instance()->map, dunes);
+    for (int count : { 10000, 50000 }) {
+        std::vector<Entity> entities;
+        for (int i = 0; i < count; ++i) {
+            Entity entity = world->create(CRAB | COMPONENT_GROUNDED);
+            Archetype& a = world->archetypeOf(entity);
+            size_t row = world->rowOf(entity);
+            a.transforms[row].position = glm::vec3(100.0f * unit(random), 0.0f, 100.0f * unit(random));
+            a.transforms[row].rotation.y = glm::pi<float>() * unit(random);
+            a.meshes[row].mesh = firstMesh + i % MESHES;
+            entities.push_back(entity);
+        }
+        std::cout << " " << count << " crabs on the seabed" << std::endl;
+        benchmark::Measure("ground following", 20, [&]() { world->updateGrounding(); });
+        benchmark::Measure("model matrices tilted to the ground", 20, [&]() { world->updateMatrices(); });
+        for (Entity entity : entities) world->destroy(entity);
+    }
+    std::swap(Seabed::Instance()->map, dunes);
+    world->meshes.resize(firstMesh);
+}
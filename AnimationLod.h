@@ -0,0 +1,75 @@
+#pragma once
+#include <cmath>
+#include <iostream>
+#include <glm.hpp>
+
+// Animation level of detail by screen size. An actor whose bounding sphere projects to fewer than
+// TIER_PIXELS[0] pixels of radius drops to tier 1 and is animated every second frame, below
+// TIER_PIXELS[1] to tier 2, animated every fourth frame and without its secondary motion. Actors of
+// a tier are spread over its frames by their ID, so every frame animates an even batch of them.
+// The tiers are compared as squared distances, see Thresholds.
+class AnimationLod {
+
+private:
+    AnimationLod() {}
+
+    AnimationLod(const AnimationLod&) = delete;
+    AnimationLod& operator=(const AnimationLod&) = delete;
+public:
+
+    static AnimationLod* Instance()
+    {
+        static AnimationLod* instance = new AnimationLod();
+        return instance;
+    }
+
+    static constexpr int TIER_COUNT = 3;
+    const int TIER_RATE[TIER_COUNT] = { 1, 2, 4 };      // frames per update, powers of two
+    const float TIER_PIXELS[TIER_COUNT - 1] = { 24.0f, 8.0f };
+
+    bool enabled = false;
+    unsigned int frame = 0;
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float pixelsPerUnit = 1.0f;                         // projected size of one unit at distance one
+
+    // squared distances from the camera where an actor of one radius drops to tier 1 and 2
+    struct Thresholds {
+        float distanceSq[TIER_COUNT - 1];
+
+        int tier(float actorDistanceSq) const {
+            return (actorDistanceSq > distanceSq[0]) + (actorDistanceSq > distanceSq[1]);
+        }
+    };
+
+    // once per frame, before the animation updates
+    void beginFrame(const glm::vec3& camera, const glm::mat4& projection, int viewportHeight) {
+        ++frame;
+        cameraPosition = camera;
+        pixelsPerUnit = 0.5f * viewportHeight * std::fabs(projection[1][1]);
+    }
+
+    // everything is tier 0 while disabled
+    Thresholds thresholds(float radius) const {
+        Thresholds result;
+        for (int t = 0; t < TIER_COUNT - 1; ++t) {
+            float distance = enabled ? radius * pixelsPerUnit / TIER_PIXELS[t] : 1e18f;
+            result.distanceSq[t] = distance * distance;
+        }
+        return result;
+    }
+
+    float distanceSq(const glm::vec3& position) const {
+        glm::vec3 d = position - cameraPosition;
+        return glm::dot(d, d);
+    }
+
+    // whether actor id of tier is animated this frame
+    bool due(int tier, unsigned int id) const {
+        return ((frame + id) & (TIER_RATE[tier] - 1)) == 0;
+    }
+
+    void setEnabled(bool value) {
+        enabled = value;
+        std::cout << "Animation LOD: " << (enabled ? "by screen size" : "off, every actor at full rate") << std::endl;
+    }
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+
+// Small timing helpers for the --benchmark command line mode (see main)
+namespace benchmark
+{
+	// run fn a few times to warm up, then report the average time per run in milliseconds
+	double Measure(const std::string& name, int iterations, const std::function<void()>& fn)
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			fn();
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < iterations; ++i)
+		{
+			fn();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double milliseconds = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+		std::cout << "  " << name << ": " << milliseconds << " ms" << std::endl;
+		return milliseconds;
+	}
+}
@@ -11,6 +11,9 @@
 
 #include "ProgramSetting.h"
 #include "ModelStructure.h"
+#include "ActorWorld.h"
+#include "PickingBvh.h"
+#include "Seabed.h"
 
 using namespace std;
 
@@ -18,6 +21,8 @@ const glm::vec3 cameraDefaultPosition(0, 48, 216);
 //const glm::vec3 cameraDefaultPosition(0, 0,10);
 glm::vec3 cameraPosition = cameraDefaultPosition; // Camera position in world space
 
+const float cameraClearance = 2.0f; // height kept above the seabed
+
 const float defaultYaw = -90;
 const float defaultPitch = 0;
 float yaw = defaultYaw;  // Horizontal rotation (around Y-axis)
@@ -28,7 +33,9 @@ int lastMouseX = 0, lastMouseY = 0;
 float angleX = 0.0f, angleY = 0.0f;
 
 // camera projection matrix used in shader
-const glm::mat4 persp_proj = glm::perspective(45.0f, (float)width / (float)height, 0.1f, 1000.0f);
+const float nearPlane = 0.1f;
+const float farPlane = 1000.0f;
+const glm::mat4 persp_proj = glm::perspective(45.0f, (float)width / (float)height, nearPlane, farPlane);
 glm::mat4 view;
 
 
@@ -107,6 +114,8 @@ namespace keyControl
 		if (keyState['r']) { // reset camera position
 			cameraPosition = cameraDefaultPosition;
 		}
+		// never below the seabed
+		cameraPosition = Seabed::Instance()->above(cameraPosition, cameraClearance);
 
 		cout << "cameraPosition: " << cameraPosition.x << " " << cameraPosition.y << " " << cameraPosition.z << endl;
 	}
@@ -129,25 +138,17 @@ namespace keyControl
 		rayOrigin = cameraPosition; // Set the origin of the ray at the camera position
 	}
 
-	bool checkRayIntersect(const glm::vec3& sphereCenter, float sphereRadius, const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
-		glm::vec3 toSphere = sphereCenter - rayOrigin;
-		float tClosest = glm::dot(toSphere, rayDirection);
-		float distanceSquared = glm::dot(toSphere, toSphere) - tClosest * tClosest;
-		return distanceSquared <= (sphereRadius * sphereRadius);
-	}
-
-
 	void processMouseClick(float mouseX, float mouseY) {
 		// Convert screen coordinates to world space (raycast setup)
 		glm::vec3 rayOrigin, rayDirection;
 		calculateRayFromScreen(mouseX, mouseY, rayOrigin, rayDirection);
 
-		// Check for intersection with crabs
-		for (auto& crab : CrabModels) {
-			if (checkRayIntersect(crab.CurrentPosition(), crab.radius, rayOrigin, rayDirection)) {
-				crab.StartRun();
-			}
-		}
+		// Nearest triangle of the scene, a crab scared by it runs away
+		PickHit hit = ScenePicker::Instance()->pick(rayOrigin, rayDirection);
+		if (hit.entity == NO_ENTITY) return;
+		ActorWorld* world = ActorWorld::Instance();
+		Archetype& owner = world->archetypeOf(hit.entity);
+		if (owner.has(COMPONENT_BEHAVIOUR)) owner.behaviours[world->rowOf(hit.entity)].StartRun();
 	}
 
 	// record the location of just pressed mouse
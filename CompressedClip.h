@@ -0,0 +1,305 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <glm.hpp>
+
+#include "Skeleton.h"
+#include "Benchmark.h"
+
+// Rotation in three 16 bit values: the largest component of the quaternion is dropped, made positive
+// and rebuilt from the unit length, the other three lie in [-1/sqrt(2), 1/sqrt(2)]. The first two
+// keep 15 bits and give their lowest bit to the index of the dropped component, the third keeps 16.
+inline void PackRotation(float x, float y, float z, float w, uint16_t* out) {
+    const float q[4] = { x, y, z, w };
+    int largest = 0;
+    for (int i = 1; i < 4; ++i)
+        if (std::fabs(q[i]) > std::fabs(q[largest])) largest = i;
+    float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+    float rest[3];
+    for (int i = 0, n = 0; i < 4; ++i)
+        if (i != largest) rest[n++] = std::min(std::max(q[i] * sign * 0.70710678f + 0.5f, 0.0f), 1.0f);
+    out[0] = uint16_t(int(rest[0] * 32767.0f + 0.5f) << 1 | (largest & 1));
+    out[1] = uint16_t(int(rest[1] * 32767.0f + 0.5f) << 1 | (largest >> 1));
+    out[2] = uint16_t(rest[2] * 65535.0f + 0.5f);
+}
+
+inline void UnpackRotation(const uint16_t* in, float& x, float& y, float& z, float& w) {
+    int largest = (in[0] & 1) | (in[1] & 1) << 1;
+    float rest[3] = { ((in[0] >> 1) * (1.0f / 32767.0f) - 0.5f) * 1.41421356f,
+                      ((in[1] >> 1) * (1.0f / 32767.0f) - 0.5f) * 1.41421356f,
+                      (in[2] * (1.0f / 65535.0f) - 0.5f) * 1.41421356f };
+    float q[4];
+    q[largest] = std::sqrt(std::max(1.0f - rest[0] * rest[0] - rest[1] * rest[1] - rest[2] * rest[2], 0.0f));
+    for (int i = 0, n = 0; i < 4; ++i)
+        if (i != largest) q[i] = rest[n++];
+    x = q[0]; y = q[1]; z = q[2]; w = q[3];
+}
+
+// Largest error a compressed clip may add to any joint, in its parent's space
+struct CompressionTolerance {
+    float rotation = 1e-3f;         // radians
+    float translation = 1e-3f;      // units
+    float scale = 1e-4f;
+};
+
+// An AnimationClip resampled at a uniform rate and quantized. Channels that stay within the tolerance
+// of one value are folded into basePose and cost nothing to sample. The rest are stored frame by
+// frame: each frame holds the rotations of all animated joints, then their translations, then their
+// scales, three 16 bit values each, and the frame that follows it comes right after. Sampling a time
+// reads two neighbouring frames front to back with no key search. Translations and scales are
+// quantized over the range of their joint. The keyframe reduction picks the rate: the key rate of
+// the source divided by the largest of DECIMATION whose error stays within the tolerance. The frames
+// are spread evenly over the duration, so they fall on source keys only where the decimation divides
+// the number of key intervals, elsewhere they land between keys and only the error check bounds them.
+struct CompressedClip {
+    static constexpr int DECIMATION_COUNT = 6;
+    static constexpr int DECIMATION[DECIMATION_COUNT] = { 8, 6, 4, 3, 2, 1 };
+    static constexpr float MAX_RATE = 120.0f;
+
+    std::string name;
+    float duration = 1.0f;                  // seconds
+    float frameRate = 30.0f;                // frames per second, frameCount - 1 of them span the duration
+    int frameCount = 0;
+    SkeletonPose basePose;                  // bind pose with the constant channels of the clip
+    std::vector<int> rotationJoints, translationJoints, scaleJoints;
+    std::vector<glm::vec3> translationMin, translationStep, scaleMin, scaleStep;
+    std::vector<uint16_t> frames;
+    float rotationError = 0.0f, translationError = 0.0f, scaleError = 0.0f;  // largest at the reference rate
+
+    int frameStride() const { return 3 * int(rotationJoints.size() + translationJoints.size() + scaleJoints.size()); }
+
+    size_t bytes() const {
+        return sizeof(*this) + frames.size() * sizeof(uint16_t) + basePose.padded() * 10 * sizeof(float)
+            + (rotationJoints.size() + translationJoints.size() + scaleJoints.size()) * sizeof(int)
+            + (translationMin.size() + scaleMin.size()) * 2 * sizeof(glm::vec3);
+    }
+};
+
+inline size_t ClipBytes(const AnimationClip& clip) {
+    size_t floats = 0;
+    for (const AnimationTrack& t : clip.tracks)
+        floats += t.positionTimes.size() * 4 + t.rotationTimes.size() * 5 + t.scaleTimes.size() * 4;
+    return sizeof(clip) + clip.tracks.size() * sizeof(AnimationTrack) + floats * sizeof(float);
+}
+
+// Pose of clip at time seconds, looping, like SampleClip of an AnimationClip. The base pose already
+// holds everything the skeleton would add, it is only taken to share that signature for SamplePalette.
+inline void SampleClip(const Skeleton&, const CompressedClip& clip, float time, PoseScratch& scratch, SkeletonPose& pose) {
+    time = std::fmod(time, clip.duration);
+    if (time < 0.0f) time += clip.duration;
+    pose = clip.basePose;
+    if (clip.frameCount < 2) return;
+    // scratch.next only matters where the weight is not 0, which are the joints written below
+    std::fill(scratch.weights.begin(), scratch.weights.end(), 0.0f);
+
+    float position = time * clip.frameRate;
+    int frame = std::min(int(position), clip.frameCount - 2);
+    float weight = std::min(position - frame, 1.0f);
+    const uint16_t* a = clip.frames.data() + size_t(frame) * clip.frameStride();
+    const uint16_t* b = a + clip.frameStride();
+
+    for (int j : clip.rotationJoints) {
+        UnpackRotation(a, pose.qx[j], pose.qy[j], pose.qz[j], pose.qw[j]);
+        UnpackRotation(b, scratch.next.qx[j], scratch.next.qy[j], scratch.next.qz[j], scratch.next.qw[j]);
+        scratch.weights[j] = weight;
+        a += 3; b += 3;
+    }
+    for (size_t t = 0; t < clip.translationJoints.size(); ++t, a += 3, b += 3) {
+        int j = clip.translationJoints[t];
+        const glm::vec3& min = clip.translationMin[t], & step = clip.translationStep[t];
+        pose.tx[j] = min.x + step.x * (a[0] + (float(b[0]) - a[0]) * weight);
+        pose.ty[j] = min.y + step.y * (a[1] + (float(b[1]) - a[1]) * weight);
+        pose.tz[j] = min.z + step.z * (a[2] + (float(b[2]) - a[2]) * weight);
+    }
+    for (size_t s = 0; s < clip.scaleJoints.size(); ++s, a += 3, b += 3) {
+        int j = clip.scaleJoints[s];
+        const glm::vec3& min = clip.scaleMin[s], & step = clip.scaleStep[s];
+        pose.sx[j] = min.x + step.x * (a[0] + (float(b[0]) - a[0]) * weight);
+        pose.sy[j] = min.y + step.y * (a[1] + (float(b[1]) - a[1]) * weight);
+        pose.sz[j] = min.z + step.z * (a[2] + (float(b[2]) - a[2]) * weight);
+    }
+    SlerpRotations(pose, scratch.next, scratch.weights.data(), pose);
+}
+
+// Angle between the rotations of joint ja of a and jb of b, from the distance between the quaternions,
+// which unlike acos of their dot product stays accurate for the small angles of the tolerance
+inline float RotationError(const SkeletonPose& a, int ja, const SkeletonPose& b, int jb) {
+    float d = a.qx[ja] * b.qx[jb] + a.qy[ja] * b.qy[jb] + a.qz[ja] * b.qz[jb] + a.qw[ja] * b.qw[jb];
+    float sign = d < 0.0f ? -1.0f : 1.0f;
+    glm::vec4 chord(a.qx[ja] - sign * b.qx[jb], a.qy[ja] - sign * b.qy[jb], a.qz[ja] - sign * b.qz[jb], a.qw[ja] - sign * b.qw[jb]);
+    return 4.0f * std::asin(std::min(0.5f * std::sqrt(glm::dot(chord, chord)), 1.0f));
+}
+
+// largest difference between two poses per channel, the rotation as an angle
+inline void PoseError(const SkeletonPose& a, const SkeletonPose& b, int joints, float& rotation, float& translation, float& scale) {
+    for (int j = 0; j < joints; ++j) {
+        rotation = std::max(rotation, RotationError(a, j, b, j));
+        translation = std::max(translation, glm::length(glm::vec3(a.tx[j] - b.tx[j], a.ty[j] - b.ty[j], a.tz[j] - b.tz[j])));
+        scale = std::max(scale, std::max(std::fabs(a.sx[j] - b.sx[j]), std::max(std::fabs(a.sy[j] - b.sy[j]), std::fabs(a.sz[j] - b.sz[j]))));
+    }
+}
+
+// clip sampled at frameCount uniform frames over its duration, quantized
+inline void EncodeFrames(const Skeleton& skeleton, const AnimationClip& clip, int frameCount, PoseScratch& scratch, CompressedClip& out) {
+    out.frameCount = frameCount;
+    out.frameRate = (frameCount - 1) / clip.duration;
+    std::vector<SkeletonPose> poses(frameCount);
+    for (int f = 0; f < frameCount; ++f) {
+        // the last frame is the end of the loop, which is its start
+        float time = f == frameCount - 1 ? 0.0f : f / out.frameRate;
+        poses[f].resize(skeleton.jointCount());
+        SampleClip(skeleton, clip, time, scratch, poses[f]);
+    }
+
+    auto range = [&](const std::vector<int>& joints, const std::vector<float> SkeletonPose::* c[3],
+        std::vector<glm::vec3>& min, std::vector<glm::vec3>& step) {
+        min.clear();
+        step.clear();
+        for (int j : joints) {
+            glm::vec3 low(1e30f), high(-1e30f);
+            for (const SkeletonPose& p : poses)
+                for (int i = 0; i < 3; ++i) {
+                    low[i] = std::min(low[i], (p.*c[i])[j]);
+                    high[i] = std::max(high[i], (p.*c[i])[j]);
+                }
+            min.push_back(low);
+            step.push_back(glm::max(high - low, glm::vec3(1e-6f)) / 65535.0f);
+        }
+    };
+    const std::vector<float> SkeletonPose::* translation[3] = { &SkeletonPose::tx, &SkeletonPose::ty, &SkeletonPose::tz };
+    const std::vector<float> SkeletonPose::* scale[3] = { &SkeletonPose::sx, &SkeletonPose::sy, &SkeletonPose::sz };
+    range(out.translationJoints, translation, out.translationMin, out.translationStep);
+    range(out.scaleJoints, scale, out.scaleMin, out.scaleStep);
+
+    out.frames.assign(size_t(frameCount) * out.frameStride(), 0);
+    uint16_t* value = out.frames.data();
+    auto quantize = [](float v, float min, float step) { return uint16_t(std::min(std::max((v - min) / step + 0.5f, 0.0f), 65535.0f)); };
+    for (const SkeletonPose& p : poses) {
+        for (int j : out.rotationJoints) {
+            PackRotation(p.qx[j], p.qy[j], p.qz[j], p.qw[j], value);
+            value += 3;
+        }
+        for (size_t t = 0; t < out.translationJoints.size(); ++t)
+            for (int i = 0; i < 3; ++i, ++value)
+                *value = quantize((p.*translation[i])[out.translationJoints[t]], out.translationMin[t][i], out.translationStep[t][i]);
+        for (size_t s = 0; s < out.scaleJoints.size(); ++s)
+            for (int i = 0; i < 3; ++i, ++value)
+                *value = quantize((p.*scale[i])[out.scaleJoints[s]], out.scaleMin[s][i], out.scaleStep[s][i]);
+    }
+}
+
+// Compressed copy of clip. The original is sampled at REFERENCE_RATE as the ground truth, channels that
+// never leave the tolerance of their first sample become constant, then the rates are tried from the
+// lowest up until every reference sample is reproduced within the tolerance. The key rate of the
+// source is that of its densest channel.
+inline CompressedClip CompressClip(const Skeleton& skeleton, const AnimationClip& clip, const CompressionTolerance& tolerance = CompressionTolerance()) {
+    const float REFERENCE_RATE = 120.0f;
+    const int joints = skeleton.jointCount();
+    PoseScratch scratch;
+    scratch.resize(joints);
+
+    int referenceCount = std::max(int(std::ceil(clip.duration * REFERENCE_RATE)), 2);
+    std::vector<float> referenceTimes(referenceCount);
+    std::vector<SkeletonPose> reference(referenceCount);
+    for (int r = 0; r < referenceCount; ++r) {
+        referenceTimes[r] = clip.duration * r / referenceCount;
+        reference[r].resize(joints);
+        SampleClip(skeleton, clip, referenceTimes[r], scratch, reference[r]);
+    }
+
+    CompressedClip out;
+    out.name = clip.name;
+    out.duration = clip.duration;
+    out.basePose = reference[0];
+    for (int j = 0; j < joints; ++j) {
+        float rotation = 0.0f, translation = 0.0f, scale = 0.0f;
+        for (const SkeletonPose& p : reference) {
+            rotation = std::max(rotation, RotationError(p, j, out.basePose, j));
+            translation = std::max(translation, glm::length(glm::vec3(p.tx[j] - out.basePose.tx[j], p.ty[j] - out.basePose.ty[j], p.tz[j] - out.basePose.tz[j])));
+            scale = std::max(scale, std::max(std::fabs(p.sx[j] - out.basePose.sx[j]),
+                std::max(std::fabs(p.sy[j] - out.basePose.sy[j]), std::fabs(p.sz[j] - out.basePose.sz[j]))));
+        }
+        if (rotation > tolerance.rotation) out.rotationJoints.push_back(j);
+        if (translation > tolerance.translation) out.translationJoints.push_back(j);
+        if (scale > tolerance.scale) out.scaleJoints.push_back(j);
+    }
+    if (out.frameStride() == 0) return out;
+
+    size_t keys = 2;
+    for (const AnimationTrack& track : clip.tracks)
+        keys = std::max({ keys, track.positionTimes.size(), track.rotationTimes.size(), track.scaleTimes.size() });
+    int intervals = std::min(int(keys) - 1, int(std::ceil(clip.duration * CompressedClip::MAX_RATE)));
+    SkeletonPose pose;
+    pose.resize(joints);
+    for (int decimation : CompressedClip::DECIMATION) {
+        if (decimation > 1 && intervals / decimation < 2) continue;
+        EncodeFrames(skeleton, clip, intervals / decimation + 1, scratch, out);
+        float rotation = 0.0f, translation = 0.0f, scale = 0.0f;
+        for (int i = 0; i < referenceCount; ++i) {
+            SampleClip(skeleton, out, referenceTimes[i], scratch, pose);
+            PoseError(reference[i], pose, joints, rotation, translation, scale);
+        }
+        out.rotationError = rotation;
+        out.translationError = translation;
+        out.scaleError = scale;
+        if (rotation <= tolerance.rotation && translation <= tolerance.translation && scale <= tolerance.scale) break;
+    }
+    // even every source key was not enough, from keys off the common rate or the quantization
+    if (out.rotationError > tolerance.rotation || out.translationError > tolerance.translation || out.scaleError > tolerance.scale)
+        std::cout << "Clip " << clip.name << " compressed over the tolerance: " << out.rotationError << " radians, "
+            << out.translationError << " units, " << out.scaleError << " scale" << std::endl;
+    return out;
+}
+
+// Memory, sampling time and error of the compressed clips of the skinning benchmark rig, and the
+// memory of a library of 40 such clips for each of 40 models.
+void benchmarkClipCompression() {
+    const int JOINTS = 40, KEYS = 30;
+    Skeleton skeleton;
+    std::vector<AnimationClip> clips;
+    MakeBenchmarkRig(JOINTS, KEYS, skeleton, clips);
+
+    std::vector<CompressedClip> compressed;
+    size_t rawBytes = 0, compressedBytes = 0;
+    for (const AnimationClip& clip : clips) {
+        compressed.push_back(CompressClip(skeleton, clip));
+        rawBytes += ClipBytes(clip);
+        compressedBytes += compressed.back().bytes();
+    }
+    std::cout << "Clip compression, " << JOINTS << " joints, " << KEYS << " keys per channel" << std::endl;
+    for (const CompressedClip& c : compressed)
+        std::cout << " " << c.name << ": " << c.rotationJoints.size() << " rotation, " << c.translationJoints.size() << " translation, "
+            << c.scaleJoints.size() << " scale channels at " << c.frameRate << " frames per second" << std::endl;
+    std::cout << " " << rawBytes / clips.size() << " bytes per clip raw, " << compressedBytes / clips.size() << " compressed, "
+        << float(rawBytes) / compressedBytes << "x; 40 clips for 40 models " << rawBytes / clips.size() * 1600 / 1024 << " KB raw, "
+        << compressedBytes / clips.size() * 1600 / 1024 << " KB compressed" << std::endl;
+
+    PoseScratch scratch;
+    scratch.resize(JOINTS);
+    SkeletonPose raw, packed;
+    raw.resize(JOINTS);
+    packed.resize(JOINTS);
+    const int SAMPLES = 10000;
+    float rotation = 0.0f, translation = 0.0f, scale = 0.0f;
+    for (int c = 0; c < 2; ++c)
+        for (int i = 0; i < SAMPLES; ++i) {
+            float time = clips[c].duration * (0.618034f * i - std::floor(0.618034f * i));
+            SampleClip(skeleton, clips[c], time, scratch, raw);
+            SampleClip(skeleton, compressed[c], time, scratch, packed);
+            PoseError(raw, packed, JOINTS, rotation, translation, scale);
+        }
+    std::cout << " max error " << rotation << " radians, " << translation << " units, " << scale << " scale" << std::endl;
+
+    benchmark::Measure(std::to_string(SAMPLES) + " samples, raw keys", 20, [&]() {
+        for (int i = 0; i < SAMPLES; ++i)
+            SampleClip(skeleton, clips[i & 1], clips[i & 1].duration * (0.618034f * i - std::floor(0.618034f * i)), scratch, raw);
+    });
+    benchmark::Measure(std::to_string(SAMPLES) + " samples, compressed", 20, [&]() {
+        for (int i = 0; i < SAMPLES; ++i)
+            SampleClip(skeleton, compressed[i & 1], compressed[i & 1].duration * (0.618034f * i - std::floor(0.618034f * i)), scratch, packed);
+    });
+}
@@ -0,0 +1,237 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <GL/glew.h>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+
+#include "ModelStructure.h"
+#include "InstanceTransform.h"
+#include "VertexAnimationTexture.h"
+#include "AnimationLod.h"
+#include "TextureManager.h"
+
+// phase of the swimming sway of fish i, the vertex shader uses the same spread for circling fish
+inline float FishPhase(int i) {
+    return std::fmod(i * 2.3999632f, glm::two_pi<float>());   // golden angle
+}
+
+// All fish in one instanced draw. The body and its child meshes (head, fin) are merged into one
+// vertex buffer with a part ID per vertex, and the vertex shader sways every part around its own
+// pivot with a per fish phase. Parts with textures of their own sample them from a texture array
+// with one layer per part ID. The simulation writes one model matrix per fish whose bottom row,
+// always (0, 0, 0, 1) for a rigid transform, carries the phase in its first element. The matrices
+// of the fish inside the view frustum are compacted and packed into 32 byte CompactTransforms, so
+// the whole school is a single upload of 32 bytes per visible fish. The sway can also be baked into a
+// vertex animation texture, which replaces the three part transforms per vertex with texture fetches.
+class FishRenderer {
+
+private:
+    FishRenderer() {}
+
+    FishRenderer(const FishRenderer&) = delete;
+    FishRenderer& operator=(const FishRenderer&) = delete;
+public:
+
+    static FishRenderer* Instance()
+    {
+        static FishRenderer* instance = new FishRenderer();
+        return instance;
+    }
+
+    static constexpr int PART_COUNT = 3;        // body, head, fin
+    const float SWING_RATE = 2.5f;              // radians per second
+    // amplitude and phase offset of the sway around the y axis, the body sways all parts
+    const glm::vec2 BODY_SWING = glm::vec2(glm::radians(2.0f), glm::radians(45.0f));
+    const glm::vec2 HEAD_SWING = glm::vec2(glm::radians(4.0f), glm::radians(90.0f));
+    const glm::vec2 FIN_SWING = glm::vec2(glm::radians(4.0f), 0.0f);
+    const glm::vec2 PART_SWING[PART_COUNT] = { glm::vec2(0.0f), HEAD_SWING, FIN_SWING };
+    static constexpr int VAT_FRAMES = 32;       // per sway cycle
+
+    GLuint vao = 0;
+    GLuint vbos[4] = { 0, 0, 0, 0 };            // position, normal, texture coordinates, part
+    GLuint instanceVBO = 0;
+    GLuint orbitVBO = 0;
+    GLuint textureId = 0;
+    GLuint textureArrayId = 0;                  // layer per part, 0 when the parts share the body texture
+    size_t vertexCount = 0;
+    std::vector<glm::mat4> visibleTransforms;   // upload staging, culled
+    std::vector<CompactTransform> packed;
+    float boundingRadius = 0.0f;                // around the fish origin, including the sway
+    size_t visibleCount = 0, culledCount = 0;   // of the last upload
+    glm::mat4 partLocal[PART_COUNT];            // pivot of each part in the body space
+    VertexAnimationTexture vat;                 // one sway cycle
+    bool vertexAnimation = false;               // play the baked sway instead of evaluating it per vertex
+
+
+    // merge the fish mesh and its child meshes, with their textures in a texture array when they differ
+    void Init(const ModelData& fish) {
+        std::vector<glm::vec3> positions, normals;
+        std::vector<glm::vec2> textureCoords;
+        std::vector<float> parts;
+        std::vector<std::string> texturePaths;
+        auto append = [&](const ModelData& mesh, int part) {
+            texturePaths.push_back(mesh.mTexturePath.empty() ? fish.mTexturePath : mesh.mTexturePath);
+            for (const glm::vec3& position : mesh.mVertices)
+                boundingRadius = std::max(boundingRadius, glm::length(glm::vec3(partLocal[part] * glm::vec4(position, 1.0f))));
+            positions.insert(positions.end(), mesh.mVertices.begin(), mesh.mVertices.end());
+            normals.insert(normals.end(), mesh.mNormals.begin(), mesh.mNormals.end());
+            textureCoords.insert(textureCoords.end(), mesh.mTextureCoords.begin(), mesh.mTextureCoords.end());
+            normals.resize(positions.size(), glm::vec3(0.0f, 1.0f, 0.0f));
+            textureCoords.resize(positions.size(), glm::vec2(0.0f));
+            parts.resize(positions.size(), float(part));
+        };
+        partLocal[0] = glm::mat4(1.0f);
+        append(fish, 0);
+        for (int i = 0; i < int(fish.mChildMeshes.size()) && i + 1 < PART_COUNT; ++i) {
+            partLocal[i + 1] = fish.mChildMeshes[i].mLocalTransform;
+            append(fish.mChildMeshes[i], i + 1);
+        }
+        boundingRadius *= 1.1f;
+        for (int i = int(fish.mChildMeshes.size()) + 1; i < PART_COUNT; ++i)
+            partLocal[i] = glm::mat4(1.0f);
+        vertexCount = positions.size();
+        textureId = fish.mTextureId;
+        if (!fish.mTexturePath.empty() && std::count(texturePaths.begin(), texturePaths.end(), texturePaths[0]) != int(texturePaths.size()))
+            textureArrayId = TextureManager::Instance()->LoadTextureArray(texturePaths);
+
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        glGenBuffers(4, vbos);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[0]);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[1]);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::vec3), normals.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[2]);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::vec2), textureCoords.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[3]);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(float), parts.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(10, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+        glEnableVertexAttribArray(10);
+
+        // compact transform per instance, position and scale then rotation and phase
+        glGenBuffers(1, &instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STREAM_DRAW);
+        for (int i = 0; i < 2; i++) {
+            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(CompactTransform), (void*)(i * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(3 + i);
+            glVertexAttribDivisor(3 + i, 1);
+        }
+
+        // orbit parameters per instance, filled when fishOnGPU is switched on
+        glGenBuffers(1, &orbitVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, orbitVBO);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+        glVertexAttribPointer(9, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glVertexAttribDivisor(9, 1);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        vat.bake(static_cast<int>(vertexCount), VAT_FRAMES, [&](float cycle, glm::vec3* bakedPositions, glm::vec3* bakedNormals) {
+            glm::mat4 transforms[PART_COUNT];
+            glm::mat3 normalMatrices[PART_COUNT];
+            for (int part = 0; part < PART_COUNT; ++part) {
+                transforms[part] = partTransform(part, glm::two_pi<float>() * cycle);
+                normalMatrices[part] = glm::transpose(glm::inverse(glm::mat3(transforms[part])));
+            }
+            for (size_t v = 0; v < vertexCount; ++v) {
+                int part = static_cast<int>(parts[v] + 0.5f);
+                bakedPositions[v] = glm::vec3(transforms[part] * glm::vec4(positions[v], 1.0f));
+                bakedNormals[v] = glm::normalize(normalMatrices[part] * normals[v]);
+            }
+        });
+    }
+
+    // fishPartTransform in simpleVertexShader.txt, wave is the swing rate times the time plus the phase
+    glm::mat4 partTransform(int part, float wave) const {
+        const glm::vec3 yAxis(0.0f, 1.0f, 0.0f);
+        float body = BODY_SWING.x * std::sin(wave + BODY_SWING.y);
+        float swing = PART_SWING[part].x * std::sin(wave + PART_SWING[part].y);
+        return glm::rotate(glm::mat4(1.0f), body, yAxis) * partLocal[part] * glm::rotate(glm::mat4(1.0f), swing, yAxis);
+    }
+
+    // store the phase of every fish in the bottom row of its transform
+    static void setPhase(glm::mat4& transform, float phase) {
+        transform[0][3] = phase;
+    }
+
+    // one upload of the fish in the frustum, the buffer is orphaned so the previous frame is not waited for
+    void uploadInstances(const std::vector<glm::mat4>& transforms, const glm::mat4& viewProjection) {
+        visibleTransforms.resize(transforms.size());
+        visibleCount = cullInstances(Frustum::FromMatrix(viewProjection), transforms.data(), transforms.size(), boundingRadius, visibleTransforms.data());
+        culledCount = transforms.size() - visibleCount;
+        packed.resize(visibleCount);
+        packTransforms(visibleTransforms.data(), packed.data(), visibleCount);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(CompactTransform), packed.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void uploadOrbits(const std::vector<glm::vec4>& orbits) {
+        glBindBuffer(GL_ARRAY_BUFFER, orbitVBO);
+        glBufferData(GL_ARRAY_BUFFER, orbits.size() * sizeof(glm::vec4), orbits.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // draw instanceCount fish, placed by their orbit parameters instead of the uploaded transforms when orbits is set
+    void render(GLuint shaderProgram, size_t instanceCount, bool orbits) {
+        if (orbits) {
+            // circling fish are placed on the GPU and not culled
+            visibleCount = instanceCount;
+            culledCount = 0;
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+
+        glUniform1i(glGetUniformLocation(shaderProgram, "texture1"), 0);
+        // the layer of a part is its ID, fishTextures is bound to unit 1 in simpleFragmentShader.txt
+        glUniform1i(glGetUniformLocation(shaderProgram, "fishTextureArray"), textureArrayId != 0);
+        if (textureArrayId != 0) {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayId);
+            glActiveTexture(GL_TEXTURE0);
+        }
+        glUniform1i(glGetUniformLocation(shaderProgram, "type"), int(Type::FISH));
+        glUniform1i(glGetUniformLocation(shaderProgram, "fishOnGPU"), orbits);
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "fishPartLocal"), PART_COUNT, GL_FALSE, glm::value_ptr(partLocal[0]));
+        glUniform2fv(glGetUniformLocation(shaderProgram, "fishPartSwing"), PART_COUNT, glm::value_ptr(PART_SWING[0]));
+        glUniform2fv(glGetUniformLocation(shaderProgram, "fishBodySwing"), 1, glm::value_ptr(BODY_SWING));
+        glUniform1f(glGetUniformLocation(shaderProgram, "fishSwingRate"), SWING_RATE);
+        // fish of the last LOD tier drop the head and fin sway
+        AnimationLod::Thresholds thresholds = AnimationLod::Instance()->thresholds(boundingRadius);
+        glUniform1f(glGetUniformLocation(shaderProgram, "fishSecondaryDistance"), std::sqrt(thresholds.distanceSq[AnimationLod::TIER_COUNT - 2]));
+        bool baked = vertexAnimation && vat.baked();
+        glUniform1i(glGetUniformLocation(shaderProgram, "fishVat"), baked);
+        if (baked) vat.bind(shaderProgram, 2);
+
+        // only the instance stream in use is read, the other one may be shorter than instanceCount
+        glBindVertexArray(vao);
+        for (int i = 3; i < 5; ++i) {
+            if (orbits) glDisableVertexAttribArray(i); else glEnableVertexAttribArray(i);
+        }
+        if (orbits) glEnableVertexAttribArray(9); else glDisableVertexAttribArray(9);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, static_cast<GLsizei>(vertexCount), static_cast<GLsizei>(instanceCount));
+        glBindVertexArray(0);
+
+        glUniform1i(glGetUniformLocation(shaderProgram, "fishOnGPU"), false);
+        glUniform1i(glGetUniformLocation(shaderProgram, "fishVat"), false);
+        glUniform1i(glGetUniformLocation(shaderProgram, "fishTextureArray"), false);
+        if (baked) vat.unbind(2);
+        if (textureArrayId != 0) {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            glActiveTexture(GL_TEXTURE0);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
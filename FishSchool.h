@@ -0,0 +1,382 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <iostream>
+#include <glm.hpp>
+
+#include "ModelStructure.h"
+#include "Seabed.h"
+#include "LavaHeightField.h"
+#include "ThreadPool.h"
+#include "FishRenderer.h"
+#include "AnimationLod.h"
+#include "Benchmark.h"
+
+// Boids fish school: separation, alignment and cohesion with the neighbours in NEIGHBOUR_RADIUS,
+// plus avoidance of the seabed and the volcano, baked into a heightmap, and of the school bounds.
+// Neighbours are found through a uniform grid over the bounds that is rebuilt every step with a
+// counting sort, which also reorders the fish so that every cell, and every run of cells along x,
+// is a contiguous range. The neighbour loops run over those ranges with SSE, the fish are split
+// over the thread pool. With the animation LOD, fish that are small on screen steer every second or
+// fourth step and keep swimming along their velocity in between.
+class FishSchool {
+
+private:
+    FishSchool() {}
+
+    FishSchool(const FishSchool&) = delete;
+    FishSchool& operator=(const FishSchool&) = delete;
+public:
+
+    static FishSchool* Instance()
+    {
+        static FishSchool* instance = new FishSchool();
+        return instance;
+    }
+
+    const float NEIGHBOUR_RADIUS = 6.0f;        // also the cell size of the grid
+    const float SEPARATION_RADIUS = 2.0f;
+    const float SEPARATION_WEIGHT = 12.0f;
+    const float ALIGNMENT_WEIGHT = 1.5f;
+    const float COHESION_WEIGHT = 0.6f;
+    const float MIN_SPEED = 4.0f;
+    const float MAX_SPEED = 12.0f;
+    const float MAX_ACCELERATION = 25.0f;
+    const float BOUNDS_MARGIN = 15.0f;          // fish turn back when closer than this to the bounds
+    const float BOUNDS_WEIGHT = 1.0f;
+    const float CLEARANCE = 8.0f;               // height kept above the seabed and the volcano
+    const float AVOID_WEIGHT = 4.0f;
+    const float LOOK_AHEAD = 1.0f;              // seconds, the slope ahead is avoided before it is reached
+    const float TIME_STEP = 1.0f / 60.0f;       // fixed simulation step
+    const int MAX_STEPS_PER_FRAME = 4;
+
+    bool enabled = false;
+    int count = 0;
+    float accumulator = 0.0f;
+    glm::vec3 boundsMin = glm::vec3(-100.0f, 10.0f, -100.0f);
+    glm::vec3 boundsMax = glm::vec3(100.0f, 190.0f, 100.0f);
+    const Seabed* seabed = Seabed::Instance();  // baked at load, nothing to avoid before that
+
+    // structure of arrays, kept in grid order between steps
+    std::vector<float> posX, posY, posZ, velX, velY, velZ;
+    std::vector<float> phase;                   // swimming sway, travels with its fish through the sort
+    std::vector<int> fishId;                    // index of the fish's transform, also travels with it
+    int tierCounts[AnimationLod::TIER_COUNT] = {};  // fish per LOD tier in the last step
+
+    // grid, the sorted copies are read by the steering pass while it writes the state above
+    std::vector<float> sortedPosX, sortedPosY, sortedPosZ, sortedVelX, sortedVelY, sortedVelZ, sortedPhase;
+    std::vector<int> sortedId;
+    std::vector<int> fishCell;
+    std::vector<int> cellStart;                 // fish of cell c are [cellStart[c], cellStart[c + 1])
+    std::vector<int> cellCursor;
+    glm::ivec3 cells = glm::ivec3(0);           // fish outside the bounds fall into the border cells
+
+
+    // spawn fishCount fish at random places above the seabed, 0 turns the school off
+    void setCount(int fishCount) {
+        enabled = fishCount > 0;
+        count = fishCount;
+        accumulator = 0.0f;
+
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        posX.resize(count); posY.resize(count); posZ.resize(count);
+        velX.resize(count); velY.resize(count); velZ.resize(count);
+        phase.resize(count);
+        fishId.resize(count);
+        for (int i = 0; i < count; ++i) {
+            posX[i] = glm::mix(boundsMin.x, boundsMax.x, unit(random));
+            posZ[i] = glm::mix(boundsMin.z, boundsMax.z, unit(random));
+            float bottom = std::min(seabed->height(posX[i], posZ[i]) + CLEARANCE, boundsMax.y);
+            posY[i] = glm::mix(std::max(bottom, boundsMin.y), boundsMax.y, unit(random));
+            float heading = unit(random) * glm::two_pi<float>();
+            float speed = glm::mix(MIN_SPEED, MAX_SPEED, unit(random));
+            velX[i] = speed * std::cos(heading);
+            velY[i] = 0.0f;
+            velZ[i] = speed * std::sin(heading);
+            phase[i] = FishPhase(i);
+            fishId[i] = i;
+        }
+
+        sortedPosX.resize(count); sortedPosY.resize(count); sortedPosZ.resize(count);
+        sortedVelX.resize(count); sortedVelY.resize(count); sortedVelZ.resize(count);
+        sortedPhase.resize(count);
+        sortedId.resize(count);
+        fishCell.resize(count);
+        for (int axis = 0; axis < 3; ++axis)
+            cells[axis] = std::max(int(std::ceil((boundsMax[axis] - boundsMin[axis]) / NEIGHBOUR_RADIUS)), 1);
+        cellStart.assign(cells.x * cells.y * cells.z + 1, 0);
+        cellCursor.assign(cells.x * cells.y * cells.z, 0);
+        if (enabled)
+            std::cout << "Fish: school of " << count << " boids" << std::endl;
+        else
+            std::cout << "Fish: circling" << std::endl;
+    }
+
+    // clamping keeps fish within NEIGHBOUR_RADIUS of each other in the same or adjacent cells
+    int cellCoord(float coord, int axis) const {
+        return glm::clamp(int(std::floor((coord - boundsMin[axis]) / NEIGHBOUR_RADIUS)), 0, cells[axis] - 1);
+    }
+
+    int cellIndex(int x, int y, int z) const {
+        return (z * cells.y + y) * cells.x + x;
+    }
+
+    // the frame time in fixed steps, like LavaFlow, then the instance transforms of the fish
+    void update(float deltaTime, std::vector<glm::mat4>& transforms) {
+        accumulator = std::min(accumulator + deltaTime, TIME_STEP * MAX_STEPS_PER_FRAME);
+        while (accumulator >= TIME_STEP) {
+            step(TIME_STEP);
+            accumulator -= TIME_STEP;
+        }
+        writeTransforms(transforms);
+    }
+
+    void step(float dt) {
+        if (count == 0) return;
+        ThreadPool* pool = ThreadPool::Instance();
+        AnimationLod* lod = AnimationLod::Instance();
+        AnimationLod::Thresholds thresholds = lod->thresholds(std::max(FishRenderer::Instance()->boundingRadius, 1.0f));
+        std::vector<int> chunkTiers(pool->ThreadCount() * AnimationLod::TIER_COUNT, 0);
+        buildGrid();
+        pool->parallelFor(count, [&](int begin, int end, int chunk) {
+            for (int i = begin; i < end; ++i) {
+                int tier = thresholds.tier(lod->distanceSq(glm::vec3(sortedPosX[i], sortedPosY[i], sortedPosZ[i])));
+                ++chunkTiers[chunk * AnimationLod::TIER_COUNT + tier];
+                if (lod->due(tier, sortedId[i]))
+                    steer(i, dt, dt * lod->TIER_RATE[tier]);
+                else
+                    drift(i, dt);
+            }
+        });
+        for (int tier = 0; tier < AnimationLod::TIER_COUNT; ++tier) {
+            tierCounts[tier] = 0;
+            for (int chunk = 0; chunk < pool->ThreadCount(); ++chunk)
+                tierCounts[tier] += chunkTiers[chunk * AnimationLod::TIER_COUNT + tier];
+        }
+    }
+
+    // counting sort of the fish by cell into the sorted arrays
+    void buildGrid() {
+        ThreadPool::Instance()->parallelFor(count, [&](int begin, int end, int) {
+            for (int i = begin; i < end; ++i)
+                fishCell[i] = cellIndex(cellCoord(posX[i], 0), cellCoord(posY[i], 1), cellCoord(posZ[i], 2));
+        });
+
+        std::fill(cellStart.begin(), cellStart.end(), 0);
+        for (int i = 0; i < count; ++i)
+            ++cellStart[fishCell[i] + 1];
+        for (size_t c = 1; c < cellStart.size(); ++c)
+            cellStart[c] += cellStart[c - 1];
+        std::copy(cellStart.begin(), cellStart.end() - 1, cellCursor.begin());
+
+        for (int i = 0; i < count; ++i) {
+            int slot = cellCursor[fishCell[i]]++;
+            sortedPosX[slot] = posX[i]; sortedPosY[slot] = posY[i]; sortedPosZ[slot] = posZ[i];
+            sortedVelX[slot] = velX[i]; sortedVelY[slot] = velY[i]; sortedVelZ[slot] = velZ[i];
+            sortedPhase[slot] = phase[i];
+            sortedId[slot] = fishId[i];
+        }
+    }
+
+    // flocking sums over the fish in [begin, end) of the sorted arrays that are within NEIGHBOUR_RADIUS of p
+    struct NeighbourSums {
+        float count = 0.0f;
+        glm::vec3 offset = glm::vec3(0.0f);     // sum of neighbour - p, for cohesion
+        glm::vec3 velocity = glm::vec3(0.0f);   // for alignment
+        glm::vec3 separation = glm::vec3(0.0f); // sum of (p - neighbour) / distance^2 within SEPARATION_RADIUS
+    };
+
+    void accumulateNeighbour(NeighbourSums& sums, const glm::vec3& p, int j) const {
+        glm::vec3 d(sortedPosX[j] - p.x, sortedPosY[j] - p.y, sortedPosZ[j] - p.z);
+        float distanceSq = glm::dot(d, d);
+        if (distanceSq <= 0.0f || distanceSq >= NEIGHBOUR_RADIUS * NEIGHBOUR_RADIUS)
+            return;
+        sums.count += 1.0f;
+        sums.offset += d;
+        sums.velocity += glm::vec3(sortedVelX[j], sortedVelY[j], sortedVelZ[j]);
+        if (distanceSq < SEPARATION_RADIUS * SEPARATION_RADIUS)
+            sums.separation -= d / distanceSq;
+    }
+
+    void accumulateRange(NeighbourSums& sums, const glm::vec3& p, int begin, int end) const {
+        int j = begin;
+#ifdef LAVA_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 radiusSq = _mm_set1_ps(NEIGHBOUR_RADIUS * NEIGHBOUR_RADIUS);
+        const __m128 separationSq = _mm_set1_ps(SEPARATION_RADIUS * SEPARATION_RADIUS);
+        const __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+        __m128 n = zero, ox = zero, oy = zero, oz = zero, vx = zero, vy = zero, vz = zero, sx = zero, sy = zero, sz = zero;
+        for (; j + 4 <= end; j += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(&sortedPosX[j]), px);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(&sortedPosY[j]), py);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(&sortedPosZ[j]), pz);
+            __m128 distanceSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 near = _mm_and_ps(_mm_cmpgt_ps(distanceSq, zero), _mm_cmplt_ps(distanceSq, radiusSq));
+            if (_mm_movemask_ps(near) == 0)
+                continue;
+            dx = _mm_and_ps(dx, near);
+            dy = _mm_and_ps(dy, near);
+            dz = _mm_and_ps(dz, near);
+            n = _mm_add_ps(n, _mm_and_ps(one, near));
+            ox = _mm_add_ps(ox, dx);
+            oy = _mm_add_ps(oy, dy);
+            oz = _mm_add_ps(oz, dz);
+            vx = _mm_add_ps(vx, _mm_and_ps(_mm_loadu_ps(&sortedVelX[j]), near));
+            vy = _mm_add_ps(vy, _mm_and_ps(_mm_loadu_ps(&sortedVelY[j]), near));
+            vz = _mm_add_ps(vz, _mm_and_ps(_mm_loadu_ps(&sortedVelZ[j]), near));
+            __m128 close = _mm_and_ps(near, _mm_cmplt_ps(distanceSq, separationSq));
+            __m128 inverseSq = _mm_and_ps(_mm_div_ps(one, _mm_max_ps(distanceSq, _mm_set1_ps(1e-12f))), close);
+            sx = _mm_sub_ps(sx, _mm_mul_ps(dx, inverseSq));
+            sy = _mm_sub_ps(sy, _mm_mul_ps(dy, inverseSq));
+            sz = _mm_sub_ps(sz, _mm_mul_ps(dz, inverseSq));
+        }
+        auto sum = [](__m128 v) {
+            float lanes[4];
+            _mm_storeu_ps(lanes, v);
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        };
+        sums.count += sum(n);
+        sums.offset += glm::vec3(sum(ox), sum(oy), sum(oz));
+        sums.velocity += glm::vec3(sum(vx), sum(vy), sum(vz));
+        sums.separation += glm::vec3(sum(sx), sum(sy), sum(sz));
+#endif
+        for (; j < end; ++j) accumulateNeighbour(sums, p, j);
+    }
+
+    // new velocity and position of sorted fish i, written to slot i of the state arrays. steerDt is the
+    // time since the fish last steered, longer than dt when the LOD skipped it.
+    void steer(int i, float dt, float steerDt) {
+        glm::vec3 p(sortedPosX[i], sortedPosY[i], sortedPosZ[i]);
+        glm::vec3 v(sortedVelX[i], sortedVelY[i], sortedVelZ[i]);
+
+        // the 3x3x3 cells around the fish as 9 contiguous runs of 3 cells along x
+        NeighbourSums sums;
+        const int cx = cellCoord(p.x, 0), cy = cellCoord(p.y, 1), cz = cellCoord(p.z, 2);
+        const int x0 = std::max(cx - 1, 0), x1 = std::min(cx + 1, cells.x - 1);
+        for (int z = std::max(cz - 1, 0); z <= std::min(cz + 1, cells.z - 1); ++z) {
+            for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, cells.y - 1); ++y) {
+                accumulateRange(sums, p, cellStart[cellIndex(x0, y, z)], cellStart[cellIndex(x1, y, z) + 1]);
+            }
+        }
+
+        glm::vec3 acceleration(0.0f);
+        if (sums.count > 0.0f) {
+            acceleration += SEPARATION_WEIGHT * sums.separation;
+            acceleration += ALIGNMENT_WEIGHT * (sums.velocity / sums.count - v);
+            acceleration += COHESION_WEIGHT * (sums.offset / sums.count);
+        }
+
+        // turn back inside the bounds
+        for (int axis = 0; axis < 3; ++axis) {
+            if (p[axis] < boundsMin[axis] + BOUNDS_MARGIN)
+                acceleration[axis] += BOUNDS_WEIGHT * (boundsMin[axis] + BOUNDS_MARGIN - p[axis]);
+            else if (p[axis] > boundsMax[axis] - BOUNDS_MARGIN)
+                acceleration[axis] -= BOUNDS_WEIGHT * (p[axis] - boundsMax[axis] + BOUNDS_MARGIN);
+        }
+
+        // climb over the seabed and the volcano, and steer down their slope where it is close
+        float ground = std::max(seabed->height(p.x, p.z), seabed->height(p.x + v.x * LOOK_AHEAD, p.z + v.z * LOOK_AHEAD));
+        float depthBelow = ground + CLEARANCE - p.y;
+        if (depthBelow > 0.0f) {
+            glm::vec2 slope = seabed->slope(p.x, p.z);
+            acceleration += AVOID_WEIGHT * depthBelow * glm::vec3(-slope.x, 1.0f, -slope.y);
+        }
+
+        float accelerationLength = glm::length(acceleration);
+        if (accelerationLength > MAX_ACCELERATION)
+            acceleration *= MAX_ACCELERATION / accelerationLength;
+        v += acceleration * steerDt;
+        float speed = glm::length(v);
+        if (speed > 1e-6f)
+            v *= glm::clamp(speed, MIN_SPEED, MAX_SPEED) / speed;
+        else
+            v = glm::vec3(MIN_SPEED, 0.0f, 0.0f);
+        p += v * dt;
+        p.y = std::max(p.y, ground);
+
+        posX[i] = p.x; posY[i] = p.y; posZ[i] = p.z;
+        velX[i] = v.x; velY[i] = v.y; velZ[i] = v.z;
+        phase[i] = sortedPhase[i];
+        fishId[i] = sortedId[i];
+    }
+
+    // sorted fish i keeps its velocity, between the steps the LOD skips, but stays inside the bounds
+    // and above the seabed, turning back from the side it hit
+    void drift(int i, float dt) {
+        glm::vec3 p(sortedPosX[i], sortedPosY[i], sortedPosZ[i]);
+        glm::vec3 v(sortedVelX[i], sortedVelY[i], sortedVelZ[i]);
+        p += v * dt;
+        glm::vec3 bottom = boundsMin;
+        bottom.y = std::min(std::max(bottom.y, seabed->height(p.x, p.z)), boundsMax.y);
+        for (int axis = 0; axis < 3; ++axis) {
+            if (p[axis] < bottom[axis]) {
+                p[axis] = bottom[axis];
+                v[axis] = std::fabs(v[axis]);
+            }
+            else if (p[axis] > boundsMax[axis]) {
+                p[axis] = boundsMax[axis];
+                v[axis] = -std::fabs(v[axis]);
+            }
+        }
+        posX[i] = p.x; posY[i] = p.y; posZ[i] = p.z;
+        velX[i] = v.x; velY[i] = v.y; velZ[i] = v.z;
+        phase[i] = sortedPhase[i];
+        fishId[i] = sortedId[i];
+    }
+
+    // model matrices facing along the velocity, the same frame as CalcFishInstanceTransform, with the phase.
+    // Every fish keeps its transform slot through the sorts.
+    void writeTransforms(std::vector<glm::mat4>& transforms) const {
+        transforms.resize(count);
+        ThreadPool::Instance()->parallelFor(count, [&](int begin, int end, int) {
+            for (int i = begin; i < end; ++i) {
+                glm::vec3 forward = glm::normalize(glm::vec3(velX[i], velY[i], velZ[i]));
+                glm::vec3 right = glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), forward);
+                float rightLength = glm::length(right);
+                right = rightLength > 1e-4f ? right / rightLength : glm::vec3(1.0f, 0.0f, 0.0f);
+                glm::vec3 up = glm::cross(forward, right);
+
+                glm::mat4& transform = transforms[fishId[i]];
+                transform[0] = glm::vec4(right, 0.0f);
+                transform[1] = glm::vec4(up, 0.0f);
+                transform[2] = glm::vec4(-forward, 0.0f);
+                transform[3] = glm::vec4(posX[i], posY[i], posZ[i], 1.0f);
+                FishRenderer::setPhase(transform, phase[i]);
+            }
+        });
+    }
+};
+
+// time a step of 1k, 10k and 50k boids on all threads, at full rate and with the animation LOD seen
+// from a camera at the edge of the school, --benchmark bakes no seabed so only the bounds steer them
+void benchmarkFishSchool() {
+    FishSchool* school = FishSchool::Instance();
+    AnimationLod* lod = AnimationLod::Instance();
+    const glm::vec3 camera(0.0f, 100.0f, -110.0f);
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 2.0f, 0.1f, 1000.0f);
+    std::vector<glm::mat4> transforms;
+    std::cout << "Fish school, " << ThreadPool::Instance()->ThreadCount() << " threads" << std::endl;
+    for (int fishCount : { 1000, 10000, 50000 }) {
+        school->setCount(fishCount);
+        // let the school form first, random fish have fewer neighbours than a flock
+        lod->enabled = false;
+        for (int i = 0; i < 120; ++i) school->step(1.0f / 60.0f);
+        for (bool lodEnabled : { false, true }) {
+            lod->enabled = lodEnabled;
+            benchmark::Measure(std::to_string(fishCount) + " fish, step + transforms" + (lodEnabled ? ", animation LOD" : ""), 30, [&]() {
+                lod->beginFrame(camera, projection, 720);
+                school->update(1.0f / 60.0f, transforms);
+            });
+        }
+        std::cout << "  fish per tier:";
+        for (int tier = 0; tier < AnimationLod::TIER_COUNT; ++tier)
+            std::cout << " " << school->tierCounts[tier] << " every " << lod->TIER_RATE[tier];
+        std::cout << std::endl;
+    }
+    lod->enabled = false;
+    school->setCount(0);
+}
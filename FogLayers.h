@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <GL/glew.h>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+
+#include "CameraControl.hpp"
+#include "ShaderUtility.h"
+#include "Seabed.h"
+
+// Haze over the seabed: a few stacked horizontal sheets over its bounds, lit by the scene lights and
+// fading with the distance to the camera in fogFragmentShader.txt. The sheets overlap each other and
+// the smoke, so they are drawn in the weighted OIT pass where no sorting is needed.
+class FogLayers {
+
+private:
+    FogLayers() {}
+
+    FogLayers(const FogLayers&) = delete;
+    FogLayers& operator=(const FogLayers&) = delete;
+public:
+
+    static FogLayers* Instance()
+    {
+        static FogLayers* instance = new FogLayers();
+        return instance;
+    }
+
+    const int LAYERS = 4;
+    const float LAYER_SPACING = 4.0f;           // first sheet this far above the lowest seabed point
+    const glm::vec3 COLOR = glm::vec3(0.05f, 0.4f, 0.6f);
+    const float DENSITY = 0.01f;                // per unit of view distance
+    const float ALPHA = 0.12f;                  // per sheet, right in front of the camera
+
+    GLuint vao = 0, vbo = 0;
+    GLuint shaderProgram;
+    GLsizei vertexCount = 0;
+
+
+    // call after Seabed::Init, the sheets cover its bounds
+    void Init() {
+        const Heightmap& map = Seabed::Instance()->map;
+        glm::vec2 boundsMin = map.origin;
+        glm::vec2 boundsMax = map.origin + map.cellSize * glm::vec2(map.resolutionX - 1, map.resolutionZ - 1);
+        float bottom = map.heights.empty() ? 0.0f : *std::min_element(map.heights.begin(), map.heights.end());
+
+        // two triangles per sheet, position and normal interleaved
+        std::vector<glm::vec3> vertices;
+        const glm::vec2 corners[6] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 0 }, { 1, 1 }, { 0, 1 } };
+        for (int layer = 0; layer < LAYERS; ++layer) {
+            float y = bottom + LAYER_SPACING * (layer + 1);
+            for (const glm::vec2& corner : corners) {
+                glm::vec2 xz = boundsMin + (boundsMax - boundsMin) * corner;
+                vertices.push_back(glm::vec3(xz.x, y, xz.y));
+                vertices.push_back(glm::vec3(0.0f, 1.0f, 0.0f));
+            }
+        }
+        vertexCount = static_cast<GLsizei>(vertices.size() / 2);
+
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)sizeof(glm::vec3));
+        glEnableVertexAttribArray(1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        shaderProgram = createShaderProgram("fogVertexShader.txt", "fogFragmentShader.txt");
+    }
+
+    // draw between WeightedOIT::begin() and end()
+    void draw() {
+        glUseProgram(shaderProgram);
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "proj"), 1, GL_FALSE, glm::value_ptr(persp_proj));
+        glUniform3fv(glGetUniformLocation(shaderProgram, "fogColor"), 1, glm::value_ptr(COLOR));
+        glUniform1f(glGetUniformLocation(shaderProgram, "density"), DENSITY);
+        glUniform1f(glGetUniformLocation(shaderProgram, "alpha"), ALPHA);
+        // the shader measures the distance in eye coordinates, where the camera is the origin
+        glUniform3f(glGetUniformLocation(shaderProgram, "viewPos"), 0.0f, 0.0f, 0.0f);
+        glUniform1i(glGetUniformLocation(shaderProgram, "isFog"), 1);
+        glUniform1i(glGetUniformLocation(shaderProgram, "weightedOIT"), 1);
+
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+        glBindVertexArray(0);
+    }
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include <glm.hpp>
+
+// View frustum as six inward facing planes (xyz = normal, w = distance), taken from a view projection matrix
+struct Frustum {
+    glm::vec4 planes[6];
+
+    static Frustum FromMatrix(const glm::mat4& viewProjection) {
+        // rows of the matrix, glm stores columns
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; ++i) {
+            row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+
+        Frustum frustum;
+        frustum.planes[0] = row[3] + row[0]; // left
+        frustum.planes[1] = row[3] - row[0]; // right
+        frustum.planes[2] = row[3] + row[1]; // bottom
+        frustum.planes[3] = row[3] - row[1]; // top
+        frustum.planes[4] = row[3] + row[2]; // near
+        frustum.planes[5] = row[3] - row[2]; // far
+        for (glm::vec4& plane : frustum.planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+        return frustum;
+    }
+
+    // false only when the box is completely outside one plane
+    bool intersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const {
+        for (const glm::vec4& plane : planes) {
+            // corner furthest along the plane normal
+            glm::vec3 corner(plane.x >= 0.0f ? boxMax.x : boxMin.x,
+                             plane.y >= 0.0f ? boxMax.y : boxMin.y,
+                             plane.z >= 0.0f ? boxMax.z : boxMin.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool intersectsSphere(const glm::vec3& center, float radius) const {
+        for (const glm::vec4& plane : planes) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+};
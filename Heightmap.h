@@ -0,0 +1,126 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <glm.hpp>
+
+#include "ModelStructure.h"
+
+// Regular grid of heights over the xz plane, baked from triangle meshes by keeping the highest
+// surface in every cell, with the slope at every grid point baked next to it. Sample() and
+// SampleSlope() interpolate bilinearly and clamp to the grid.
+struct Heightmap {
+    glm::vec2 origin = glm::vec2(0.0f);  // world xz of grid point (0, 0)
+    float cellSize = 1.0f;
+    int resolutionX = 0, resolutionZ = 0;
+    std::vector<float> heights;
+    std::vector<glm::vec2> slopes;       // height change per unit along x and z
+
+    float& at(int x, int z) { return heights[z * resolutionX + x]; }
+    float at(int x, int z) const { return heights[z * resolutionX + x]; }
+
+    void Resize(const glm::vec2& gridOrigin, float gridCellSize, int sizeX, int sizeZ, float height) {
+        origin = gridOrigin;
+        cellSize = gridCellSize;
+        resolutionX = sizeX;
+        resolutionZ = sizeZ;
+        heights.assign(sizeX * sizeZ, height);
+        slopes.assign(sizeX * sizeZ, glm::vec2(0.0f));
+    }
+
+    // rasterise the triangle lists of the models and their children, cells hit by no triangle keep emptyHeight
+    void Bake(const std::vector<ModelData>& models, float emptyHeight) {
+        const float unset = -1e30f;
+        std::fill(heights.begin(), heights.end(), unset);
+        for (const ModelData& model : models) {
+            BakeModel(model);
+        }
+        for (float& height : heights) {
+            if (height == unset)
+                height = emptyHeight;
+        }
+        BakeSlopes();
+    }
+
+    // central differences, one sided at the border
+    void BakeSlopes() {
+        slopes.resize(heights.size());
+        for (int z = 0; z < resolutionZ; ++z) {
+            int zBelow = std::max(z - 1, 0), zAbove = std::min(z + 1, resolutionZ - 1);
+            for (int x = 0; x < resolutionX; ++x) {
+                int xBelow = std::max(x - 1, 0), xAbove = std::min(x + 1, resolutionX - 1);
+                slopes[z * resolutionX + x] = glm::vec2(
+                    xAbove > xBelow ? (at(xAbove, z) - at(xBelow, z)) / ((xAbove - xBelow) * cellSize) : 0.0f,
+                    zAbove > zBelow ? (at(x, zAbove) - at(x, zBelow)) / ((zAbove - zBelow) * cellSize) : 0.0f);
+            }
+        }
+    }
+
+    void BakeModel(const ModelData& model) {
+        for (size_t i = 0; i + 2 < model.mVertices.size(); i += 3) {
+            BakeTriangle(model.mVertices[i], model.mVertices[i + 1], model.mVertices[i + 2]);
+        }
+        for (const ModelData& child : model.mChildMeshes) {
+            BakeModel(child);
+        }
+    }
+
+    // top down barycentric rasterisation at the grid points
+    void BakeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        float area = (b.x - a.x) * (c.z - a.z) - (c.x - a.x) * (b.z - a.z);
+        if (std::abs(area) < 1e-8f)
+            return; // vertical or degenerate
+
+        int x0 = std::max(int(std::floor((std::min({ a.x, b.x, c.x }) - origin.x) / cellSize)), 0);
+        int x1 = std::min(int(std::ceil((std::max({ a.x, b.x, c.x }) - origin.x) / cellSize)), resolutionX - 1);
+        int z0 = std::max(int(std::floor((std::min({ a.z, b.z, c.z }) - origin.y) / cellSize)), 0);
+        int z1 = std::min(int(std::ceil((std::max({ a.z, b.z, c.z }) - origin.y) / cellSize)), resolutionZ - 1);
+        for (int z = z0; z <= z1; ++z) {
+            for (int x = x0; x <= x1; ++x) {
+                float px = origin.x + x * cellSize, pz = origin.y + z * cellSize;
+                float wa = ((b.x - px) * (c.z - pz) - (c.x - px) * (b.z - pz)) / area;
+                float wb = ((c.x - px) * (a.z - pz) - (a.x - px) * (c.z - pz)) / area;
+                float wc = 1.0f - wa - wb;
+                if (wa < 0.0f || wb < 0.0f || wc < 0.0f)
+                    continue;
+                float& height = at(x, z);
+                height = std::max(height, wa * a.y + wb * b.y + wc * c.y);
+            }
+        }
+    }
+
+    // grid cell under a world position and the position inside it
+    void Locate(float worldX, float worldZ, int& x0, int& z0, float& fx, float& fz) const {
+        float gx = glm::clamp((worldX - origin.x) / cellSize, 0.0f, float(resolutionX - 1));
+        float gz = glm::clamp((worldZ - origin.y) / cellSize, 0.0f, float(resolutionZ - 1));
+        x0 = std::min(int(gx), resolutionX - 2);
+        z0 = std::min(int(gz), resolutionZ - 2);
+        fx = gx - x0;
+        fz = gz - z0;
+    }
+
+    float Sample(float worldX, float worldZ) const {
+        int x0, z0;
+        float fx, fz;
+        Locate(worldX, worldZ, x0, z0, fx, fz);
+        float top = glm::mix(at(x0, z0), at(x0 + 1, z0), fx);
+        float bottom = glm::mix(at(x0, z0 + 1), at(x0 + 1, z0 + 1), fx);
+        return glm::mix(top, bottom, fz);
+    }
+
+    glm::vec2 SampleSlope(float worldX, float worldZ) const {
+        int x0, z0;
+        float fx, fz;
+        Locate(worldX, worldZ, x0, z0, fx, fz);
+        const glm::vec2* row = &slopes[z0 * resolutionX + x0];
+        glm::vec2 top = glm::mix(row[0], row[1], fx);
+        glm::vec2 bottom = glm::mix(row[resolutionX], row[resolutionX + 1], fx);
+        return glm::mix(top, bottom, fz);
+    }
+
+    // upward surface normal
+    glm::vec3 SampleNormal(float worldX, float worldZ) const {
+        glm::vec2 slope = SampleSlope(worldX, worldZ);
+        return glm::normalize(glm::vec3(-slope.x, 1.0f, -slope.y));
+    }
+};
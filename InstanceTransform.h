@@ -0,0 +1,265 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <iostream>
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+
+#include "LavaHeightField.h"
+#include "Frustum.h"
+#include "Benchmark.h"
+
+// Instance transform in 32 bytes instead of a 64 byte mat4, for instanced draws of rigid actors
+// with a uniform scale: position and scale, then the rotation quaternion with w >= 0 so that only
+// x, y, z are stored, and a free float for per instance data such as an animation phase.
+// decodeInstance in simpleVertexShader.txt rebuilds the matrix.
+struct CompactTransform {
+    glm::vec4 positionScale;    // xyz position, w uniform scale, negative for a mirrored transform
+    glm::vec4 rotationExtra;    // xyz of the unit quaternion with w >= 0, w free
+};
+
+// Quaternion of a rotation matrix by Shepperd's method: the largest of w, x, y, z comes from the
+// diagonal and the other three from the off diagonal divided by it, so that none of them is taken
+// from a difference near 0. That matters for the half turns, whose w is 0: a mirrored yaw-only frame
+// like the fish ones becomes one once the sign goes to the scale. The quaternion is then negated to
+// w >= 0. A negative determinant goes into the sign of the scale, CalcFishInstanceTransform builds
+// such a mirrored frame. extra is read from column 0 row 3, where the fish keep their phase (see
+// FishRenderer::setPhase).
+inline void packTransform(const glm::mat4& m, CompactTransform& out) {
+    float scale = std::sqrt(m[0][0] * m[0][0] + m[0][1] * m[0][1] + m[0][2] * m[0][2]);
+    if (glm::dot(glm::vec3(m[0]), glm::cross(glm::vec3(m[1]), glm::vec3(m[2]))) < 0.0f)
+        scale = -scale;
+    float inverse = scale != 0.0f ? 1.0f / scale : 0.0f;
+    // row r, column c of the rotation
+    auto r = [&](int row, int column) { return m[column][row] * inverse; };
+    float tw = 1.0f + r(0, 0) + r(1, 1) + r(2, 2), tx = 1.0f + r(0, 0) - r(1, 1) - r(2, 2);
+    float ty = 1.0f - r(0, 0) + r(1, 1) - r(2, 2), tz = 1.0f - r(0, 0) - r(1, 1) + r(2, 2);
+    float t;
+    glm::vec4 q;
+    if (tw >= tx && tw >= ty && tw >= tz) {
+        t = tw;
+        q = glm::vec4(r(2, 1) - r(1, 2), r(0, 2) - r(2, 0), r(1, 0) - r(0, 1), tw);
+    } else if (tx >= ty && tx >= tz) {
+        t = tx;
+        q = glm::vec4(tx, r(0, 1) + r(1, 0), r(0, 2) + r(2, 0), r(2, 1) - r(1, 2));
+    } else if (ty >= tz) {
+        t = ty;
+        q = glm::vec4(r(0, 1) + r(1, 0), ty, r(1, 2) + r(2, 1), r(0, 2) - r(2, 0));
+    } else {
+        t = tz;
+        q = glm::vec4(r(0, 2) + r(2, 0), r(1, 2) + r(2, 1), tz, r(1, 0) - r(0, 1));
+    }
+    q *= 0.5f / std::sqrt(std::max(t, 1e-30f));
+    if (q.w < 0.0f) q = -q;
+    float length = std::sqrt(glm::dot(q, q));
+    out.positionScale = glm::vec4(m[3][0], m[3][1], m[3][2], scale);
+    out.rotationExtra = glm::vec4(q.x / length, q.y / length, q.z / length, m[0][3]);
+}
+
+// pack count matrices, four at a time with SSE, where all four of Shepperd's cases are computed and
+// each lane keeps the one of its largest component
+inline void packTransforms(const glm::mat4* transforms, CompactTransform* out, size_t count) {
+    size_t i = 0;
+#ifdef LAVA_SSE
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    for (; i + 4 <= count; i += 4) {
+        const float* m = &transforms[i][0][0];
+        // column c of the four matrices, transposed so that every register holds one element of all four
+        __m128 col[4][4];
+        for (int c = 0; c < 4; ++c) {
+            col[c][0] = _mm_loadu_ps(m + c * 4);
+            col[c][1] = _mm_loadu_ps(m + 16 + c * 4);
+            col[c][2] = _mm_loadu_ps(m + 32 + c * 4);
+            col[c][3] = _mm_loadu_ps(m + 48 + c * 4);
+            _MM_TRANSPOSE4_PS(col[c][0], col[c][1], col[c][2], col[c][3]);
+        }
+        __m128 scale = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0][0], col[0][0]), _mm_mul_ps(col[0][1], col[0][1])),
+            _mm_mul_ps(col[0][2], col[0][2])));
+        // sign of the determinant c0 . (c1 x c2)
+        __m128 crossX = _mm_sub_ps(_mm_mul_ps(col[1][1], col[2][2]), _mm_mul_ps(col[1][2], col[2][1]));
+        __m128 crossY = _mm_sub_ps(_mm_mul_ps(col[1][2], col[2][0]), _mm_mul_ps(col[1][0], col[2][2]));
+        __m128 crossZ = _mm_sub_ps(_mm_mul_ps(col[1][0], col[2][1]), _mm_mul_ps(col[1][1], col[2][0]));
+        __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0][0], crossX), _mm_mul_ps(col[0][1], crossY)), _mm_mul_ps(col[0][2], crossZ));
+        __m128 inverse = _mm_and_ps(_mm_div_ps(one, _mm_max_ps(scale, _mm_set1_ps(1e-30f))), _mm_cmpgt_ps(scale, zero));
+        scale = _mm_xor_ps(scale, _mm_and_ps(_mm_cmplt_ps(determinant, zero), signMask));
+        inverse = _mm_xor_ps(inverse, _mm_and_ps(_mm_cmplt_ps(determinant, zero), signMask));
+        __m128 r00 = _mm_mul_ps(col[0][0], inverse), r11 = _mm_mul_ps(col[1][1], inverse), r22 = _mm_mul_ps(col[2][2], inverse);
+
+        // off diagonal sums and differences, col[c][r] is row r of column c
+        __m128 s01 = _mm_mul_ps(_mm_add_ps(col[1][0], col[0][1]), inverse);
+        __m128 s02 = _mm_mul_ps(_mm_add_ps(col[2][0], col[0][2]), inverse);
+        __m128 s12 = _mm_mul_ps(_mm_add_ps(col[2][1], col[1][2]), inverse);
+        __m128 dx = _mm_mul_ps(_mm_sub_ps(col[1][2], col[2][1]), inverse);
+        __m128 dy = _mm_mul_ps(_mm_sub_ps(col[2][0], col[0][2]), inverse);
+        __m128 dz = _mm_mul_ps(_mm_sub_ps(col[0][1], col[1][0]), inverse);
+        __m128 tw = _mm_add_ps(one, _mm_add_ps(_mm_add_ps(r00, r11), r22));
+        __m128 tx = _mm_add_ps(one, _mm_sub_ps(_mm_sub_ps(r00, r11), r22));
+        __m128 ty = _mm_add_ps(one, _mm_sub_ps(_mm_sub_ps(r11, r00), r22));
+        __m128 tz = _mm_add_ps(one, _mm_sub_ps(_mm_sub_ps(r22, r00), r11));
+
+        auto select = [](__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); };
+        __m128 useW = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(tw, tx), _mm_cmpge_ps(tw, ty)), _mm_cmpge_ps(tw, tz));
+        __m128 useX = _mm_and_ps(_mm_cmpge_ps(tx, ty), _mm_cmpge_ps(tx, tz));
+        __m128 useY = _mm_cmpge_ps(ty, tz);
+        auto pick = [&](__m128 w, __m128 x, __m128 y, __m128 z) { return select(useW, w, select(useX, x, select(useY, y, z))); };
+        __m128 qx = pick(dx, tx, s01, s02);
+        __m128 qy = pick(dy, s01, ty, s12);
+        __m128 qz = pick(dz, s02, s12, tz);
+        __m128 qw = pick(tw, dx, dy, dz);
+        // every case is the quaternion times 4 times its largest component: negated to w >= 0 and normalized
+        __m128 flip = _mm_and_ps(_mm_cmplt_ps(qw, zero), signMask);
+        qx = _mm_xor_ps(qx, flip);
+        qy = _mm_xor_ps(qy, flip);
+        qz = _mm_xor_ps(qz, flip);
+        qw = _mm_xor_ps(qw, flip);
+        __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_add_ps(_mm_mul_ps(qz, qz), _mm_mul_ps(qw, qw)));
+        __m128 normalize = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+        qx = _mm_mul_ps(qx, normalize);
+        qy = _mm_mul_ps(qy, normalize);
+        qz = _mm_mul_ps(qz, normalize);
+
+        // back to one vec4 pair per instance
+        __m128 px = col[3][0], py = col[3][1], pz = col[3][2], extra = col[0][3];
+        _MM_TRANSPOSE4_PS(px, py, pz, scale);
+        _MM_TRANSPOSE4_PS(qx, qy, qz, extra);
+        float* o = &out[i].positionScale.x;
+        _mm_storeu_ps(o, px);      _mm_storeu_ps(o + 4, qx);
+        _mm_storeu_ps(o + 8, py);  _mm_storeu_ps(o + 12, qy);
+        _mm_storeu_ps(o + 16, pz); _mm_storeu_ps(o + 20, qz);
+        _mm_storeu_ps(o + 24, scale); _mm_storeu_ps(o + 28, extra);
+    }
+#endif
+    for (; i < count; ++i) packTransform(transforms[i], out[i]);
+}
+
+// the matrix the shader rebuilds, extra goes back to column 0 row 3
+inline glm::mat4 unpackTransform(const CompactTransform& packed) {
+    glm::vec3 v(packed.rotationExtra);
+    float w = std::sqrt(std::max(0.0f, 1.0f - glm::dot(v, v)));
+    float x = v.x, y = v.y, z = v.z, s = packed.positionScale.w;
+    glm::mat4 m(1.0f);
+    m[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y), 0.0f) * s;
+    m[1] = glm::vec4(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x), 0.0f) * s;
+    m[2] = glm::vec4(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y), 0.0f) * s;
+    m[3] = glm::vec4(glm::vec3(packed.positionScale), 1.0f);
+    m[0][3] = packed.rotationExtra.w;
+    return m;
+}
+
+// Copy the transforms whose bounding sphere, radius in world units around the translation, touches
+// the frustum to the front of visible and return how many there are. Four spheres at a time with SSE.
+// visibleIndex, when given, receives the index in transforms of every visible one.
+inline size_t cullInstances(const Frustum& frustum, const glm::mat4* transforms, size_t count, float radius, glm::mat4* visible,
+    size_t* visibleIndex = nullptr) {
+    size_t visibleCount = 0;
+    size_t i = 0;
+#ifdef LAVA_SSE
+    const __m128 negativeRadius = _mm_set1_ps(-radius);
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(&transforms[i][3][0]);
+        __m128 y = _mm_loadu_ps(&transforms[i + 1][3][0]);
+        __m128 z = _mm_loadu_ps(&transforms[i + 2][3][0]);
+        __m128 w = _mm_loadu_ps(&transforms[i + 3][3][0]);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        __m128 inside = _mm_cmpeq_ps(negativeRadius, negativeRadius);   // all lanes set
+        for (const glm::vec4& plane : frustum.planes) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; ++lane) {
+            if (mask & (1 << lane)) {
+                if (visibleIndex) visibleIndex[visibleCount] = i + lane;
+                visible[visibleCount++] = transforms[i + lane];
+            }
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        if (frustum.intersectsSphere(glm::vec3(transforms[i][3]), radius)) {
+            if (visibleIndex) visibleIndex[visibleCount] = i;
+            visible[visibleCount++] = transforms[i];
+        }
+    }
+    return visibleCount;
+}
+
+// Bytes and CPU time per frame for 10k to 100k instances: copying mat4s into the upload buffer against
+// packing them. The GPU fetches 64 or 32 bytes of instance attributes for every vertex it shades.
+void benchmarkInstanceTransforms() {
+    // round trip of the mirrored yaw-only frames of CalcFishInstanceTransform, half turns once the
+    // mirror is removed, over every heading through both packing paths
+    {
+        const int HEADINGS = 3600;
+        std::vector<glm::mat4> frames(HEADINGS);
+        for (int h = 0; h < HEADINGS; ++h) {
+            float angle = glm::two_pi<float>() * h / HEADINGS;
+            glm::vec3 forward(-std::sin(angle), 0.0f, std::cos(angle));
+            glm::vec3 right = glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), forward));
+            frames[h] = glm::mat4(1.0f);
+            frames[h][0] = glm::vec4(right * 2.0f, 0.0f);
+            frames[h][1] = glm::vec4(glm::cross(forward, right) * 2.0f, 0.0f);
+            frames[h][2] = glm::vec4(-forward * 2.0f, 0.0f);
+            frames[h][3] = glm::vec4(forward * 50.0f, 1.0f);
+        }
+        std::vector<CompactTransform> scalar(HEADINGS), simd(HEADINGS);
+        for (int h = 0; h < HEADINGS; ++h) packTransform(frames[h], scalar[h]);
+        packTransforms(frames.data(), simd.data(), HEADINGS);
+        float scalarError = 0.0f, simdError = 0.0f;
+        for (int h = 0; h < HEADINGS; ++h) {
+            glm::mat4 a = unpackTransform(scalar[h]), b = unpackTransform(simd[h]);
+            for (int c = 0; c < 3; ++c) {
+                scalarError = std::max(scalarError, glm::length(glm::vec3(a[c]) - glm::vec3(frames[h][c])));
+                simdError = std::max(simdError, glm::length(glm::vec3(b[c]) - glm::vec3(frames[h][c])));
+            }
+        }
+        std::cout << "Instance transforms, mirrored yaw-only frames over " << HEADINGS << " headings, max error scalar "
+            << scalarError << ", SSE " << simdError << std::endl;
+    }
+
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::cout << "Instance transforms, " << sizeof(glm::mat4) << " against " << sizeof(CompactTransform)
+        << " bytes of instance attributes fetched per shaded vertex" << std::endl;
+    for (int count : { 10000, 50000, 100000 }) {
+        std::vector<glm::mat4> transforms(count);
+        for (glm::mat4& m : transforms) {
+            glm::vec3 forward = glm::normalize(glm::vec3(unit(random), unit(random) * 0.3f, unit(random)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+            glm::vec3 right = glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), forward));
+            float scale = 1.0f + 0.5f * unit(random);
+            m[0] = glm::vec4(right * scale, unit(random));
+            m[1] = glm::vec4(glm::cross(forward, right) * scale, 0.0f);
+            m[2] = glm::vec4(-forward * scale, 0.0f);
+            m[3] = glm::vec4(unit(random) * 100.0f, unit(random) * 100.0f, unit(random) * 100.0f, 1.0f);
+        }
+        std::vector<glm::mat4> staging(count);
+        std::vector<CompactTransform> packed(count);
+
+        std::cout << " " << count << " instances, mat4 " << count * sizeof(glm::mat4) / 1024 << " KB, compact "
+            << count * sizeof(CompactTransform) / 1024 << " KB per upload" << std::endl;
+        benchmark::Measure("mat4 copy", 50, [&]() { std::memcpy(staging.data(), transforms.data(), count * sizeof(glm::mat4)); });
+        benchmark::Measure("compact pack, scalar", 50, [&]() { for (int i = 0; i < count; ++i) packTransform(transforms[i], packed[i]); });
+        benchmark::Measure("compact pack, SSE", 50, [&]() { packTransforms(transforms.data(), packed.data(), count); });
+
+        float maxError = 0.0f;
+        for (int i = 0; i < count; ++i) {
+            glm::mat4 decoded = unpackTransform(packed[i]);
+            for (int c = 0; c < 3; ++c)
+                maxError = std::max(maxError, glm::length(glm::vec3(decoded[c]) - glm::vec3(transforms[i][c])));
+        }
+        std::cout << "  max rotation error after decoding: " << maxError << std::endl;
+
+        // a camera at the edge of the instances looking across them
+        glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f)
+            * glm::lookAt(glm::vec3(0.0f, 0.0f, -120.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        Frustum frustum = Frustum::FromMatrix(viewProjection);
+        size_t visibleCount = 0;
+        benchmark::Measure("frustum cull and compact, SSE", 50, [&]() { visibleCount = cullInstances(frustum, transforms.data(), count, 2.0f, staging.data()); });
+        std::cout << "  " << count - visibleCount << " of " << count << " culled" << std::endl;
+    }
+}
@@ -0,0 +1,402 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <GL/glew.h>
+#include <glm.hpp>
+
+#include "ModelStructure.h"
+#include "Heightmap.h"
+#include "LavaHeightField.h"
+#include "LavaTiles.h"
+#include "ParticleSystem.h"
+#include "ThreadPool.h"
+#include "Benchmark.h"
+
+// Lava flow as a virtual pipe shallow water model on a square grid over the lava area. Every cell
+// holds a lava depth and a temperature on top of the baked seabed. Virtual pipes to the four
+// neighbours carry an outflow that is accelerated by the height difference and damped by a
+// temperature dependent viscosity, and thin sheets are slowed down further. Lava cools faster where it is thin and solidifies into the
+// terrain below the solidus. The crater feeds it.
+// The passes run over row bands on the thread pool with SSE for the interior cells.
+class LavaFlow {
+
+private:
+    LavaFlow() {}
+
+    LavaFlow(const LavaFlow&) = delete;
+    LavaFlow& operator=(const LavaFlow&) = delete;
+public:
+
+    static LavaFlow* Instance()
+    {
+        static LavaFlow* instance = new LavaFlow();
+        return instance;
+    }
+
+    static constexpr int RESOLUTION = 512;      // cells per side while rendering, as timed by the benchmark
+    const float TIME_STEP = 1.0f / 60.0f;       // fixed solver step
+    const int MAX_STEPS_PER_FRAME = 4;
+    const float GRAVITY = 9.81f;
+    const float VISCOSITY_HOT = 0.5f;           // flux damping per second at temperature 1
+    const float VISCOSITY_COLD = 40.0f;         // at temperature 0
+    const float SHEET_DEPTH = 0.5f;             // thinner lava is held back by friction, drag ~ 1 / depth^2
+    const float COOLING = 0.5f;                 // relative temperature loss per second of a thin sheet...
+    const float COOLING_DEPTH = 0.2f;           // ...halved at this depth, deep lava keeps its heat
+    const float SOLIDUS = 0.15f;                // below this temperature lava turns into rock
+    const float SOLIDIFY_RATE = 0.5f;           // fraction of the depth turned into rock per second
+    const float SOURCE_RATE = 40.0f;            // lava volume per second from the crater
+    const float SOURCE_RADIUS = 3.0f;
+    const float HIDE_DEPTH = 0.5f;              // dry vertices sink below the seabed
+    const float WET_DEPTH = 0.01f;
+
+    bool enabled = false;
+    int resolution = 0;
+    float cellSize = 1.0f;
+    glm::vec2 origin;                           // world xz of cell (0, 0)
+    glm::vec2 sourceCenter;                     // world xz of the crater
+    float accumulator = 0.0f;
+
+    // structure of arrays, row major
+    std::vector<float> terrain;
+    std::vector<float> depth, depthNext;
+    std::vector<float> temperature, temperatureNext;   // 0 solid .. 1 erupting
+    std::vector<float> fluxXNeg, fluxXPos, fluxZNeg, fluxZPos;
+    std::vector<int> sourceCells;
+
+    // lava mesh output
+    GLuint temperatureVBO = 0;
+    std::vector<float> vertexTemperature;
+    float terrainMin = 0.0f, terrainMax = 0.0f;
+
+
+    // start an empty flow over ground, which also defines the grid
+    void Reset(const Heightmap& ground, const glm::vec2& source) {
+        resolution = ground.resolutionX;
+        cellSize = ground.cellSize;
+        origin = ground.origin;
+        sourceCenter = source;
+        accumulator = 0.0f;
+
+        const int cells = resolution * resolution;
+        terrain = ground.heights;
+        depth.assign(cells, 0.0f);
+        depthNext.assign(cells, 0.0f);
+        temperature.assign(cells, 0.0f);
+        temperatureNext.assign(cells, 0.0f);
+        fluxXNeg.assign(cells, 0.0f);
+        fluxXPos.assign(cells, 0.0f);
+        fluxZNeg.assign(cells, 0.0f);
+        fluxZPos.assign(cells, 0.0f);
+
+        sourceCells.clear();
+        for (int z = 0; z < resolution; ++z) {
+            for (int x = 0; x < resolution; ++x) {
+                glm::vec2 cell = origin + glm::vec2(x, z) * cellSize;
+                if (glm::length(cell - sourceCenter) <= std::max(SOURCE_RADIUS, cellSize))
+                    sourceCells.push_back(z * resolution + x);
+            }
+        }
+        terrainMin = *std::min_element(terrain.begin(), terrain.end());
+        terrainMax = *std::max_element(terrain.begin(), terrain.end());
+    }
+
+    // bake the seabed under the lava area, start the flow and add a temperature attribute to the lava mesh
+    void Init(ModelData& lava) {
+        Heightmap ground;
+        ground.Resize(glm::vec2(lavaPosition.x - lavaWidth * 0.5f, lavaPosition.z - lavaDepth * 0.5f),
+            lavaWidth / (RESOLUTION - 1), RESOLUTION, RESOLUTION, lavaPosition.y);
+        ground.Bake(staticModels, lavaPosition.y);
+        glm::vec3 crater = ParticleSystem::Instance()->startPosition;
+        Reset(ground, glm::vec2(crater.x, crater.z));
+
+        vertexTemperature.assign(lava.mPointCount, 0.0f);
+        glBindVertexArray(lava.mVao);
+        glGenBuffers(1, &temperatureVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, temperatureVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexTemperature.size() * sizeof(float), vertexTemperature.data(), GL_DYNAMIC_DRAW);
+        glVertexAttribPointer(8, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+        glEnableVertexAttribArray(8);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void setEnabled(bool value) {
+        enabled = value;
+        accumulator = 0.0f;
+        // the flow leaves the wave displacement range, so the tile bounds follow the terrain instead
+        if (enabled)
+            lavaTiles.setVerticalBounds(terrainMin - lavaPosition.y - HIDE_DEPTH, terrainMax - lavaPosition.y + 10.0f);
+        else
+            lavaTiles.setVerticalBounds(-lavaHeightField.displacementBounds().y, lavaHeightField.displacementBounds().y);
+        std::cout << "Lava: " << (enabled ? "shallow water flow from the crater" : "waves") << std::endl;
+    }
+
+    // run fixed steps for the elapsed time
+    void update(float deltaTime) {
+        accumulator = std::min(accumulator + deltaTime, TIME_STEP * MAX_STEPS_PER_FRAME);
+        while (accumulator >= TIME_STEP) {
+            step(TIME_STEP);
+            accumulator -= TIME_STEP;
+        }
+    }
+
+    void step(float dt) {
+        addSource(dt);
+        ThreadPool* pool = ThreadPool::Instance();
+        pool->parallelFor(resolution, [&](int begin, int end, int) { fluxRows(begin, end, dt); });
+        pool->parallelFor(resolution, [&](int begin, int end, int) { depthRows(begin, end, dt); });
+        depth.swap(depthNext);
+        temperature.swap(temperatureNext);
+    }
+
+    void addSource(float dt) {
+        if (sourceCells.empty()) return;
+        const float added = dt * SOURCE_RATE / (sourceCells.size() * cellSize * cellSize);
+        for (int i : sourceCells) {
+            // mix the heat of the fresh lava into the cell
+            float total = depth[i] + added;
+            temperature[i] = (temperature[i] * depth[i] + added) / total;
+            depth[i] = total;
+        }
+    }
+
+    float damping(float cellTemperature, float dt) const {
+        return 1.0f / (1.0f + dt * (VISCOSITY_HOT + (VISCOSITY_COLD - VISCOSITY_HOT) * (1.0f - cellTemperature)));
+    }
+
+    // outflow of one cell, pipes leading out of the grid stay closed
+    void fluxCell(int x, int z, float dt) {
+        const int i = z * resolution + x;
+        const float mobility = depth[i] * depth[i] / (depth[i] * depth[i] + SHEET_DEPTH * SHEET_DEPTH);
+        const float pipe = dt * GRAVITY * cellSize * mobility;
+        const float damp = damping(temperature[i], dt);
+        const float height = terrain[i] + depth[i];
+        auto outflow = [&](float flux, int neighbour, bool open) {
+            if (!open) return 0.0f;
+            return std::max(0.0f, flux * damp + pipe * (height - terrain[neighbour] - depth[neighbour]));
+        };
+        float xNeg = outflow(fluxXNeg[i], i - 1, x > 0);
+        float xPos = outflow(fluxXPos[i], i + 1, x < resolution - 1);
+        float zNeg = outflow(fluxZNeg[i], i - resolution, z > 0);
+        float zPos = outflow(fluxZPos[i], i + resolution, z < resolution - 1);
+
+        // never drain more than the cell holds
+        float total = (xNeg + xPos + zNeg + zPos) * dt;
+        float scale = total > 0.0f ? std::min(1.0f, depth[i] * cellSize * cellSize / total) : 0.0f;
+        fluxXNeg[i] = xNeg * scale;
+        fluxXPos[i] = xPos * scale;
+        fluxZNeg[i] = zNeg * scale;
+        fluxZPos[i] = zPos * scale;
+    }
+
+    void fluxRows(int rowBegin, int rowEnd, float dt) {
+        for (int z = rowBegin; z < rowEnd; ++z) {
+            if (z == 0 || z == resolution - 1) {
+                for (int x = 0; x < resolution; ++x) fluxCell(x, z, dt);
+                continue;
+            }
+            fluxCell(0, z, dt);
+            int x = 1;
+#ifdef LAVA_SSE
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 step = _mm_set1_ps(dt);
+            const __m128 gravity = _mm_set1_ps(dt * GRAVITY * cellSize);
+            const __m128 sheet = _mm_set1_ps(SHEET_DEPTH * SHEET_DEPTH);
+            const __m128 area = _mm_set1_ps(cellSize * cellSize);
+            const __m128 viscosityHot = _mm_set1_ps(dt * VISCOSITY_HOT);
+            const __m128 viscosityRange = _mm_set1_ps(dt * (VISCOSITY_COLD - VISCOSITY_HOT));
+            for (; x + 4 <= resolution - 1; x += 4) {
+                const int i = z * resolution + x;
+                __m128 d = _mm_loadu_ps(&depth[i]);
+                __m128 height = _mm_add_ps(_mm_loadu_ps(&terrain[i]), d);
+                __m128 cold = _mm_sub_ps(one, _mm_loadu_ps(&temperature[i]));
+                __m128 damp = _mm_div_ps(one, _mm_add_ps(one, _mm_add_ps(viscosityHot, _mm_mul_ps(viscosityRange, cold))));
+                __m128 depthSq = _mm_mul_ps(d, d);
+                __m128 pipe = _mm_mul_ps(gravity, _mm_div_ps(depthSq, _mm_add_ps(depthSq, sheet)));
+
+                const int neighbours[4] = { i - 1, i + 1, i - resolution, i + resolution };
+                float* fluxes[4] = { &fluxXNeg[i], &fluxXPos[i], &fluxZNeg[i], &fluxZPos[i] };
+                __m128 out[4];
+                __m128 total = zero;
+                for (int n = 0; n < 4; ++n) {
+                    __m128 neighbourHeight = _mm_add_ps(_mm_loadu_ps(&terrain[neighbours[n]]), _mm_loadu_ps(&depth[neighbours[n]]));
+                    out[n] = _mm_max_ps(zero, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(fluxes[n]), damp),
+                        _mm_mul_ps(pipe, _mm_sub_ps(height, neighbourHeight))));
+                    total = _mm_add_ps(total, out[n]);
+                }
+                total = _mm_mul_ps(total, step);
+
+                // scale = total > 0 ? min(1, volume / total) : 0
+                __m128 positive = _mm_cmpgt_ps(total, zero);
+                __m128 scale = _mm_min_ps(one, _mm_div_ps(_mm_mul_ps(d, area), _mm_max_ps(total, _mm_set1_ps(1e-12f))));
+                scale = _mm_and_ps(scale, positive);
+                for (int n = 0; n < 4; ++n) {
+                    _mm_storeu_ps(fluxes[n], _mm_mul_ps(out[n], scale));
+                }
+            }
+#endif
+            for (; x < resolution; ++x) fluxCell(x, z, dt);
+        }
+    }
+
+    // new depth and temperature of one cell from the pipes in and out, then cooling and solidification
+    void depthCell(int x, int z, float dt) {
+        const int i = z * resolution + x;
+        const float inverseArea = 1.0f / (cellSize * cellSize);
+        float inflow = 0.0f, heatIn = 0.0f;
+        auto pipeIn = [&](float flux, int neighbour) {
+            inflow += flux;
+            heatIn += flux * temperature[neighbour];
+        };
+        if (x > 0) pipeIn(fluxXPos[i - 1], i - 1);
+        if (x < resolution - 1) pipeIn(fluxXNeg[i + 1], i + 1);
+        if (z > 0) pipeIn(fluxZPos[i - resolution], i - resolution);
+        if (z < resolution - 1) pipeIn(fluxZNeg[i + resolution], i + resolution);
+        float outflow = fluxXNeg[i] + fluxXPos[i] + fluxZNeg[i] + fluxZPos[i];
+
+        float newDepth = std::max(0.0f, depth[i] + dt * (inflow - outflow) * inverseArea);
+        float heat = depth[i] * temperature[i] + dt * (heatIn - outflow * temperature[i]) * inverseArea;
+        float newTemperature = newDepth > WET_DEPTH ? glm::clamp(heat / newDepth, 0.0f, 1.0f) : 0.0f;
+        newTemperature = std::max(0.0f, newTemperature - dt * COOLING * newTemperature * COOLING_DEPTH / (newDepth + COOLING_DEPTH));
+
+        if (newTemperature < SOLIDUS) {
+            float solid = newDepth * std::min(1.0f, dt * SOLIDIFY_RATE);
+            newDepth -= solid;
+            terrain[i] += solid;
+        }
+        depthNext[i] = newDepth;
+        temperatureNext[i] = newTemperature;
+    }
+
+    void depthRows(int rowBegin, int rowEnd, float dt) {
+        for (int z = rowBegin; z < rowEnd; ++z) {
+            if (z == 0 || z == resolution - 1) {
+                for (int x = 0; x < resolution; ++x) depthCell(x, z, dt);
+                continue;
+            }
+            depthCell(0, z, dt);
+            int x = 1;
+#ifdef LAVA_SSE
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 stepOverArea = _mm_set1_ps(dt / (cellSize * cellSize));
+            const __m128 wet = _mm_set1_ps(WET_DEPTH);
+            const __m128 coolingDepth = _mm_set1_ps(COOLING_DEPTH);
+            const __m128 cooling = _mm_set1_ps(dt * COOLING * COOLING_DEPTH);
+            const __m128 solidus = _mm_set1_ps(SOLIDUS);
+            const __m128 solidify = _mm_set1_ps(std::min(1.0f, dt * SOLIDIFY_RATE));
+            for (; x + 4 <= resolution - 1; x += 4) {
+                const int i = z * resolution + x;
+                const int n = resolution;
+                __m128 d = _mm_loadu_ps(&depth[i]);
+                __m128 t = _mm_loadu_ps(&temperature[i]);
+
+                __m128 inLeft = _mm_loadu_ps(&fluxXPos[i - 1]);
+                __m128 inRight = _mm_loadu_ps(&fluxXNeg[i + 1]);
+                __m128 inTop = _mm_loadu_ps(&fluxZPos[i - n]);
+                __m128 inBottom = _mm_loadu_ps(&fluxZNeg[i + n]);
+                __m128 inflow = _mm_add_ps(_mm_add_ps(inLeft, inRight), _mm_add_ps(inTop, inBottom));
+                __m128 heatIn = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(inLeft, _mm_loadu_ps(&temperature[i - 1])), _mm_mul_ps(inRight, _mm_loadu_ps(&temperature[i + 1]))),
+                    _mm_add_ps(_mm_mul_ps(inTop, _mm_loadu_ps(&temperature[i - n])), _mm_mul_ps(inBottom, _mm_loadu_ps(&temperature[i + n]))));
+                __m128 outflow = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(&fluxXNeg[i]), _mm_loadu_ps(&fluxXPos[i])),
+                    _mm_add_ps(_mm_loadu_ps(&fluxZNeg[i]), _mm_loadu_ps(&fluxZPos[i])));
+
+                __m128 newDepth = _mm_max_ps(zero, _mm_add_ps(d, _mm_mul_ps(stepOverArea, _mm_sub_ps(inflow, outflow))));
+                __m128 heat = _mm_add_ps(_mm_mul_ps(d, t), _mm_mul_ps(stepOverArea, _mm_sub_ps(heatIn, _mm_mul_ps(outflow, t))));
+                __m128 isWet = _mm_cmpgt_ps(newDepth, wet);
+                __m128 newTemperature = _mm_div_ps(heat, _mm_max_ps(newDepth, wet));
+                newTemperature = _mm_and_ps(_mm_min_ps(one, _mm_max_ps(zero, newTemperature)), isWet);
+                newTemperature = _mm_max_ps(zero, _mm_sub_ps(newTemperature,
+                    _mm_div_ps(_mm_mul_ps(cooling, newTemperature), _mm_add_ps(newDepth, coolingDepth))));
+
+                __m128 solid = _mm_and_ps(_mm_mul_ps(newDepth, solidify), _mm_cmplt_ps(newTemperature, solidus));
+                _mm_storeu_ps(&terrain[i], _mm_add_ps(_mm_loadu_ps(&terrain[i]), solid));
+                _mm_storeu_ps(&depthNext[i], _mm_sub_ps(newDepth, solid));
+                _mm_storeu_ps(&temperatureNext[i], newTemperature);
+            }
+#endif
+            for (; x < resolution; ++x) depthCell(x, z, dt);
+        }
+    }
+
+    // bilinear lookup of a per cell field at a world position
+    float sample(const std::vector<float>& field, float worldX, float worldZ) const {
+        float gx = glm::clamp((worldX - origin.x) / cellSize, 0.0f, float(resolution - 1));
+        float gz = glm::clamp((worldZ - origin.y) / cellSize, 0.0f, float(resolution - 1));
+        int x0 = std::min(int(gx), resolution - 2), z0 = std::min(int(gz), resolution - 2);
+        float fx = gx - x0, fz = gz - z0;
+        const float* row0 = &field[z0 * resolution + x0];
+        const float* row1 = row0 + resolution;
+        return glm::mix(glm::mix(row0[0], row0[1], fx), glm::mix(row1[0], row1[1], fx), fz);
+    }
+
+    // Move the lava vertices onto the flow surface, dry vertices sink just below the seabed,
+    // then upload the visible tiles and the temperatures
+    void writeMesh(ModelData& lava, const LavaHeightField& grid) {
+        const int rows = grid.rows, cols = grid.cols;
+        ThreadPool::Instance()->parallelFor(rows, [&](int begin, int end, int) {
+            for (int r = begin; r < end; ++r) {
+                float worldZ = grid.baseZ[r] + lavaPosition.z;
+                for (int c = 0; c < cols; ++c) {
+                    float worldX = grid.baseX[c] + lavaPosition.x;
+                    float flowDepth = sample(depth, worldX, worldZ);
+                    float ground = sample(terrain, worldX, worldZ);
+                    float y = flowDepth > WET_DEPTH ? ground + flowDepth : ground - HIDE_DEPTH;
+                    lava.mVertices[r * cols + c] = glm::vec3(grid.baseX[c], y - lavaPosition.y, grid.baseZ[r]);
+                    vertexTemperature[r * cols + c] = flowDepth > WET_DEPTH ? sample(temperature, worldX, worldZ) : 0.0f;
+                }
+            }
+        });
+        ThreadPool::Instance()->parallelFor(rows, [&](int begin, int end, int) {
+            for (int r = begin; r < end; ++r) {
+                for (int c = 0; c < cols; ++c) {
+                    int left = std::max(c - 1, 0), right = std::min(c + 1, cols - 1);
+                    int up = std::max(r - 1, 0), down = std::min(r + 1, rows - 1);
+                    float slopeX = (lava.mVertices[r * cols + right].y - lava.mVertices[r * cols + left].y) / (grid.baseX[right] - grid.baseX[left]);
+                    float slopeZ = (lava.mVertices[down * cols + c].y - lava.mVertices[up * cols + c].y) / (grid.baseZ[down] - grid.baseZ[up]);
+                    lava.mNormals[r * cols + c] = glm::normalize(glm::vec3(-slopeX, 1.0f, -slopeZ));
+                }
+            }
+        });
+
+        for (LavaTile& tile : lavaTiles.tiles)
+            tile.dirty = tile.visible;
+        lavaTiles.upload(lava, lava);
+
+        glBindBuffer(GL_ARRAY_BUFFER, temperatureVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vertexTemperature.size() * sizeof(float), vertexTemperature.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
+
+// Solver steps on a 512 x 512 cone with 1, 2, 4 ... threads, no GL needed
+void benchmarkLavaFlow() {
+    const int size = 512;
+    Heightmap cone;
+    cone.Resize(glm::vec2(-75.0f), 150.0f / (size - 1), size, size, 0.0f);
+    for (int z = 0; z < size; ++z) {
+        for (int x = 0; x < size; ++x) {
+            glm::vec2 p = cone.origin + glm::vec2(x, z) * cone.cellSize;
+            cone.at(x, z) = std::max(0.0f, 35.0f - 0.5f * glm::length(p));
+        }
+    }
+
+    LavaFlow* flow = LavaFlow::Instance();
+    ThreadPool* pool = ThreadPool::Instance();
+    std::cout << "Lava flow " << size << "x" << size << std::endl;
+    for (int threads = 1; ; threads *= 2) {
+        threads = std::min(threads, pool->ThreadCount());
+        pool->SetActiveThreadCount(threads);
+        flow->Reset(cone, glm::vec2(0.0f));
+        // let some lava spread first so the measured steps move real flow
+        for (int i = 0; i < 120; ++i) flow->step(flow->TIME_STEP);
+        benchmark::Measure(std::to_string(threads) + " threads, one step", 60, [&]() { flow->step(flow->TIME_STEP); });
+        if (threads == pool->ThreadCount()) break;
+    }
+    pool->SetActiveThreadCount(pool->ThreadCount());
+}
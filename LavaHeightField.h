@@ -0,0 +1,169 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define LAVA_SSE 1
+#endif
+
+#include "ModelStructure.h"
+
+// One wave travelling along a single grid axis: amplitude * shape(frequency * coord + speed * time + phase).
+// Any sum of these stays separable, height(x, z) = X(x) + Z(z), so a frame needs O(rows + cols)
+// trig calls and the per vertex work is plain adds.
+struct AxisWave {
+    float amplitude = 0.0f;
+    float frequency = 0.0f;
+    float speed = 1.0f;
+    float phase = 0.0f;
+    bool cosine = false;     // cos instead of sin
+    float steepness = 0.0f;  // Gerstner, 0..1: moves vertices along the axis towards the crests, 1 gives cusps
+};
+
+struct LavaWaveModel {
+    std::vector<AxisWave> xWaves;
+    std::vector<AxisWave> zWaves;
+};
+
+// Separable height field kernel for a regular grid. Each frame builds per axis tables of height,
+// Gerstner offset and slope, then fills heights and normals row by row with SIMD adds.
+class LavaHeightField {
+public:
+    int rows = 0, cols = 0;
+    LavaWaveModel waves;
+
+    // undisplaced grid coordinates
+    std::vector<float> baseX, baseZ;
+
+    // per axis tables, rebuilt every frame
+    std::vector<float> heightX, offsetX, slopeX;
+    std::vector<float> heightZ, offsetZ, slopeZ;
+
+    // per vertex results, row major, structure of arrays
+    std::vector<float> heights, normalX, normalY, normalZ;
+
+
+    void init(int gridRows, int gridCols, const std::vector<glm::vec3>& vertices) {
+        rows = gridRows;
+        cols = gridCols;
+        baseX.resize(cols);
+        baseZ.resize(rows);
+        for (int x = 0; x < cols; ++x) baseX[x] = vertices[x].x;
+        for (int z = 0; z < rows; ++z) baseZ[z] = vertices[z * cols].z;
+
+        heightX.resize(cols); offsetX.resize(cols); slopeX.resize(cols);
+        heightZ.resize(rows); offsetZ.resize(rows); slopeZ.resize(rows);
+        heights.resize(rows * cols);
+        normalX.resize(rows * cols);
+        normalY.resize(rows * cols);
+        normalZ.resize(rows * cols);
+    }
+
+    // sum the waves of one axis into height and offset tables, then take central differences
+    static void buildAxisTable(const std::vector<AxisWave>& axisWaves, const std::vector<float>& base, float time,
+        std::vector<float>& height, std::vector<float>& offset, std::vector<float>& slope) {
+        const int count = static_cast<int>(base.size());
+        std::fill(height.begin(), height.end(), 0.0f);
+        std::fill(offset.begin(), offset.end(), 0.0f);
+        for (const AxisWave& wave : axisWaves) {
+            for (int i = 0; i < count; ++i) {
+                float angle = wave.frequency * base[i] + wave.speed * time + wave.phase;
+                float s = std::sin(angle), c = std::cos(angle);
+                height[i] += wave.amplitude * (wave.cosine ? c : s);
+                // derivative of the shape, Gerstner pinches the crests
+                if (wave.frequency > 0.0f)
+                    offset[i] += wave.steepness / wave.frequency * (wave.cosine ? -s : c);
+            }
+        }
+        for (int i = 0; i < count; ++i) {
+            int prev = std::max(i - 1, 0), next = std::min(i + 1, count - 1);
+            float run = (base[next] + offset[next]) - (base[prev] + offset[prev]);
+            slope[i] = run != 0.0f ? (height[next] - height[prev]) / run : 0.0f;
+        }
+    }
+
+    void buildTables(float time) {
+        buildAxisTable(waves.xWaves, baseX, time, heightX, offsetX, slopeX);
+        buildAxisTable(waves.zWaves, baseZ, time, heightZ, offsetZ, slopeZ);
+    }
+
+    // height = X + Z, normal = normalize(-slopeX, 1, -slopeZ) for rows [rowBegin, rowEnd) and columns [colBegin, colEnd)
+    void fillBlock(int rowBegin, int rowEnd, int colBegin, int colEnd) {
+        for (int z = rowBegin; z < rowEnd; ++z) {
+            const int row = z * cols;
+            const float hz = heightZ[z];
+            const float sz = slopeZ[z];
+            int x = colBegin;
+#ifdef LAVA_SSE
+            const __m128 rowHeight = _mm_set1_ps(hz);
+            const __m128 rowSlopeSq = _mm_set1_ps(sz * sz + 1.0f);
+            const __m128 negRowSlope = _mm_set1_ps(-sz);
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128 threeHalves = _mm_set1_ps(1.5f);
+            for (; x + 4 <= colEnd; x += 4) {
+                __m128 h = _mm_add_ps(_mm_loadu_ps(&heightX[x]), rowHeight);
+                _mm_storeu_ps(&heights[row + x], h);
+
+                // 1 / length with one Newton step on top of rsqrt
+                __m128 sx = _mm_loadu_ps(&slopeX[x]);
+                __m128 lengthSq = _mm_add_ps(_mm_mul_ps(sx, sx), rowSlopeSq);
+                __m128 inverseLength = _mm_rsqrt_ps(lengthSq);
+                inverseLength = _mm_mul_ps(inverseLength,
+                    _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, lengthSq), _mm_mul_ps(inverseLength, inverseLength))));
+
+                _mm_storeu_ps(&normalX[row + x], _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), sx), inverseLength));
+                _mm_storeu_ps(&normalY[row + x], inverseLength);
+                _mm_storeu_ps(&normalZ[row + x], _mm_mul_ps(negRowSlope, inverseLength));
+            }
+#endif
+            for (; x < colEnd; ++x) {
+                heights[row + x] = heightX[x] + hz;
+                float inverseLength = 1.0f / std::sqrt(slopeX[x] * slopeX[x] + sz * sz + 1.0f);
+                normalX[row + x] = -slopeX[x] * inverseLength;
+                normalY[row + x] = inverseLength;
+                normalZ[row + x] = -sz * inverseLength;
+            }
+        }
+    }
+
+    void fillRows(int rowBegin, int rowEnd) {
+        fillBlock(rowBegin, rowEnd, 0, cols);
+    }
+
+    void update(float time) {
+        buildTables(time);
+        fillRows(0, rows);
+    }
+
+    // interleave a block of the results into the lava vertex and normal arrays
+    void writeBlock(ModelData& lava, int rowBegin, int rowEnd, int colBegin, int colEnd) const {
+        for (int z = rowBegin; z < rowEnd; ++z) {
+            const int row = z * cols;
+            const float pz = baseZ[z] + offsetZ[z];
+            for (int x = colBegin; x < colEnd; ++x) {
+                lava.mVertices[row + x] = glm::vec3(baseX[x] + offsetX[x], heights[row + x], pz);
+                lava.mNormals[row + x] = glm::vec3(normalX[row + x], normalY[row + x], normalZ[row + x]);
+            }
+        }
+    }
+
+    void writeRows(ModelData& lava, int rowBegin, int rowEnd) const {
+        writeBlock(lava, rowBegin, rowEnd, 0, cols);
+    }
+
+    // how far the waves move vertices from the flat grid, for bounding boxes
+    glm::vec2 displacementBounds() const {
+        glm::vec2 bounds(0.0f); // horizontal, vertical
+        for (const std::vector<AxisWave>* axisWaves : { &waves.xWaves, &waves.zWaves }) {
+            for (const AxisWave& wave : *axisWaves) {
+                bounds.y += std::abs(wave.amplitude);
+                if (wave.frequency > 0.0f)
+                    bounds.x = std::max(bounds.x, wave.steepness / wave.frequency);
+            }
+        }
+        return bounds;
+    }
+};
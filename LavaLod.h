@@ -0,0 +1,147 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <GL/glew.h>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+
+#include "ModelStructure.h"
+#include "lava.h"
+
+// Continuous distance dependent LOD (CDLOD) for the lava surface. A quadtree over a large square is
+// walked from the camera every frame, and every selected node draws the same small grid patch with
+// instancing. The vertex shader displaces the patch with the lava waves and geomorphs each vertex
+// onto the next coarser grid as it nears the end of its level's range, so neighbouring levels meet
+// without cracks or popping. The vertex count depends on the LOD ranges, not on the covered area.
+class LavaLod {
+
+private:
+    LavaLod() {}
+
+    LavaLod(const LavaLod&) = delete;
+    LavaLod& operator=(const LavaLod&) = delete;
+public:
+
+    static LavaLod* Instance()
+    {
+        static LavaLod* instance = new LavaLod();
+        return instance;
+    }
+
+    static constexpr int PATCH_CELLS = 16;      // quads per patch side
+    const float WORLD_SIZE = 4096.0f;           // side of the covered square, centred on lavaPosition
+    const float LEAF_SIZE = 32.0f;              // side of the finest nodes
+    const float RANGE_SCALE = 4.0f;             // level L is used up to RANGE_SCALE * its node size from the camera
+    const float MORPH_START = 0.85f;            // fraction of the range where the morph to the next level begins
+
+    bool enabled = false;
+    int rootLevel = 0;
+
+    ModelData patch;
+    GLuint nodeVBO = 0;
+    std::vector<glm::vec4> nodes;   // x, z of the node corner in lava space, node size, level
+
+
+    void Init() {
+        rootLevel = static_cast<int>(std::round(std::log2(WORLD_SIZE / LEAF_SIZE)));
+
+        // unit grid in cell coordinates, the shader scales it to each node
+        const int side = PATCH_CELLS + 1;
+        for (int z = 0; z < side; ++z) {
+            for (int x = 0; x < side; ++x) {
+                patch.mVertices.push_back(glm::vec3(float(x), 0.0f, float(z)));
+            }
+        }
+        patch.mPointCount = patch.mVertices.size();
+        generateGridIndices(patch, side, side, GL_TRIANGLE_STRIP);
+
+        glGenVertexArrays(1, &patch.mVao);
+        glBindVertexArray(patch.mVao);
+        glGenBuffers(1, &patch.mVBOs[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, patch.mVBOs[0]);
+        glBufferData(GL_ARRAY_BUFFER, patch.mPointCount * sizeof(glm::vec3), patch.mVertices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(0);
+
+        glGenBuffers(1, &patch.mEBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, patch.mEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, patch.IndexCount() * patch.IndexSize(), patch.IndexData(), GL_STATIC_DRAW);
+
+        // one node per instance
+        glGenBuffers(1, &nodeVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, nodeVBO);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
+        glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glEnableVertexAttribArray(7);
+        glVertexAttribDivisor(7, 1);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void setEnabled(bool value) {
+        enabled = value;
+        std::cout << "Lava surface: " << (enabled ? "CDLOD field" : "single grid") << std::endl;
+    }
+
+    float range(int level) const {
+        return RANGE_SCALE * LEAF_SIZE * float(1 << level);
+    }
+
+    // distance from the camera to the closest point of a node on the undisplaced plane
+    static float distanceToNode(const glm::vec4& node, const glm::vec3& camera) {
+        float dx = std::max(std::max(node.x - camera.x, camera.x - (node.x + node.z)), 0.0f);
+        float dz = std::max(std::max(node.y - camera.z, camera.z - (node.y + node.z)), 0.0f);
+        return std::sqrt(dx * dx + camera.y * camera.y + dz * dz);
+    }
+
+    // split a node while any part of it is inside the range of the next finer level
+    void selectNode(const glm::vec4& node, const glm::vec3& camera) {
+        int level = static_cast<int>(node.w);
+        if (level == 0 || distanceToNode(node, camera) > range(level - 1)) {
+            nodes.push_back(node);
+            return;
+        }
+        float half = node.z * 0.5f;
+        for (int i = 0; i < 4; ++i) {
+            selectNode(glm::vec4(node.x + half * (i & 1), node.y + half * (i >> 1), half, float(level - 1)), camera);
+        }
+    }
+
+    // select the nodes for a camera given in lava space (camera position minus lavaPosition)
+    void update(const glm::vec3& camera) {
+        nodes.clear();
+        selectNode(glm::vec4(-WORLD_SIZE * 0.5f, -WORLD_SIZE * 0.5f, WORLD_SIZE, float(rootLevel)), camera);
+
+        glBindBuffer(GL_ARRAY_BUFFER, nodeVBO);
+        glBufferData(GL_ARRAY_BUFFER, nodes.size() * sizeof(glm::vec4), nodes.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // draw all selected nodes with the terrain shader, which must be in use
+    void render(GLuint shaderProgram, const glm::mat4& modelMatrix, GLuint textureId) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+        glUniform1i(glGetUniformLocation(shaderProgram, "texture1"), 0);
+        glUniform1i(glGetUniformLocation(shaderProgram, "type"), int(Type::LAVA));
+        glUniform1i(glGetUniformLocation(shaderProgram, "lavaLod"), true);
+        glUniform1f(glGetUniformLocation(shaderProgram, "lodPatchCells"), float(PATCH_CELLS));
+        glUniform1f(glGetUniformLocation(shaderProgram, "lodRange"), range(0));
+        glUniform1f(glGetUniformLocation(shaderProgram, "lodMorphStart"), MORPH_START);
+        glUniform1f(glGetUniformLocation(shaderProgram, "lodTextureSize"), lavaWidth);
+
+        glBindVertexArray(patch.mVao);
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(patch.RestartIndex());
+        glDrawElementsInstanced(patch.mPrimitive, static_cast<GLsizei>(patch.IndexCount()), patch.mIndexType, 0, static_cast<GLsizei>(nodes.size()));
+        glDisable(GL_PRIMITIVE_RESTART);
+        glBindVertexArray(0);
+
+        glUniform1i(glGetUniformLocation(shaderProgram, "lavaLod"), false);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
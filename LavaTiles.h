@@ -0,0 +1,161 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <GL/glew.h>
+#include <glm.hpp>
+
+#include "ModelStructure.h"
+#include "Frustum.h"
+#include "lava.h"
+
+// One square block of the lava grid with its own bounds and index range
+struct LavaTile {
+    int rowBegin = 0, rowEnd = 0;        // vertex rows [begin, end), the last row is shared with the next tile
+    int colBegin = 0, colEnd = 0;        // vertex columns [begin, end)
+    glm::vec3 boundsMin, boundsMax;      // lava space, including the wave displacement
+    size_t indexOffset = 0, indexCount = 0;
+    bool visible = true;
+    bool dirty = false;                  // updated this frame, upload pending
+    float lastUpdate = -1.0f;
+};
+
+// The lava grid split into tiles. Tiles outside the view frustum are neither updated nor drawn,
+// far tiles are updated at a reduced rate, and only the buffer ranges of updated tiles are uploaded.
+class LavaTiles {
+public:
+    const int TILE_QUADS = lavaStripBand;   // same width as the strip bands, keeps their cache reuse
+    const float FAR_DISTANCE = 120.0f;      // tiles further than this from the camera...
+    const float FAR_INTERVAL = 0.1f;        // ...are updated at most this often, in seconds
+
+    int rows = 0, cols = 0;
+    int tilesX = 0, tilesZ = 0;
+    std::vector<LavaTile> tiles;
+    int visibleCount = 0, updatedCount = 0;
+
+
+    // split the grid and rebuild its index buffer tile by tile, call before the buffers are created
+    void build(ModelData& lava, int gridRows, int gridCols) {
+        rows = gridRows;
+        cols = gridCols;
+        tilesX = (cols - 2) / TILE_QUADS + 1;
+        tilesZ = (rows - 2) / TILE_QUADS + 1;
+
+        if (lavaHeightField.waves.xWaves.empty() && lavaHeightField.waves.zWaves.empty())
+            lavaHeightField.waves = DefaultLavaWaves();
+        lavaHeightField.init(rows, cols, lava.mVertices);
+        glm::vec2 displacement = lavaHeightField.displacementBounds();
+
+        lava.mIndices.clear();
+        lava.mIndices16.clear();
+        tiles.assign(tilesX * tilesZ, LavaTile());
+        for (int tz = 0; tz < tilesZ; ++tz) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                LavaTile& tile = tiles[tz * tilesX + tx];
+                int quadRowBegin = tz * TILE_QUADS, quadRowEnd = std::min(quadRowBegin + TILE_QUADS, rows - 1);
+                int quadColBegin = tx * TILE_QUADS, quadColEnd = std::min(quadColBegin + TILE_QUADS, cols - 1);
+                tile.rowBegin = quadRowBegin;
+                tile.rowEnd = quadRowEnd + 1;
+                tile.colBegin = quadColBegin;
+                tile.colEnd = quadColEnd + 1;
+
+                const glm::vec3& first = lava.mVertices[tile.rowBegin * cols + tile.colBegin];
+                const glm::vec3& last = lava.mVertices[(tile.rowEnd - 1) * cols + tile.colEnd - 1];
+                tile.boundsMin = glm::vec3(first.x - displacement.x, -displacement.y, first.z - displacement.x);
+                tile.boundsMax = glm::vec3(last.x + displacement.x, displacement.y, last.z + displacement.x);
+
+                tile.indexOffset = lava.IndexCount();
+                tile.indexCount = appendGridBlock(lava, cols, quadRowBegin, quadRowEnd, quadColBegin, quadColEnd);
+            }
+        }
+    }
+
+    // replace the height range of every tile, in lava space
+    void setVerticalBounds(float minY, float maxY) {
+        for (LavaTile& tile : tiles) {
+            tile.boundsMin.y = minY;
+            tile.boundsMax.y = maxY;
+        }
+    }
+
+    // test the tiles against the view frustum, position is the lava translation
+    void cull(const glm::mat4& viewProjection, const glm::vec3& position) {
+        Frustum frustum = Frustum::FromMatrix(viewProjection);
+        visibleCount = 0;
+        for (LavaTile& tile : tiles) {
+            tile.visible = frustum.intersectsBox(tile.boundsMin + position, tile.boundsMax + position);
+            visibleCount += tile.visible;
+        }
+    }
+
+    // visible and near, or visible and not updated for FAR_INTERVAL
+    bool isDue(const LavaTile& tile, float time, const glm::vec3& camera) const {
+        if (!tile.visible)
+            return false;
+        glm::vec3 closest = glm::clamp(camera, tile.boundsMin, tile.boundsMax);
+        return glm::length(camera - closest) <= FAR_DISTANCE || time - tile.lastUpdate >= FAR_INTERVAL;
+    }
+
+    // CPU heights and normals for the tiles that are due, then upload what changed
+    void update(ModelData& lava, float time, const glm::vec3& camera) {
+        updatedCount = 0;
+        lavaHeightField.buildTables(time);
+        for (LavaTile& tile : tiles) {
+            if (!isDue(tile, time, camera))
+                continue;
+
+            lavaHeightField.fillBlock(tile.rowBegin, tile.rowEnd, tile.colBegin, tile.colEnd);
+            lavaHeightField.writeBlock(lava, tile.rowBegin, tile.rowEnd, tile.colBegin, tile.colEnd);
+            tile.lastUpdate = time;
+            tile.dirty = true;
+            ++updatedCount;
+        }
+        if (updatedCount > 0)
+            upload(lava, lava);
+    }
+
+    // upload the rows of the dirty tiles from source into the lava buffers,
+    // neighbouring dirty tiles in a tile row become one range per vertex row
+    void upload(const ModelData& lava, const ModelData& source) {
+        for (int tz = 0; tz < tilesZ; ++tz) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                if (!tiles[tz * tilesX + tx].dirty)
+                    continue;
+                int runEnd = tx;
+                while (runEnd + 1 < tilesX && tiles[tz * tilesX + runEnd + 1].dirty)
+                    ++runEnd;
+
+                const LavaTile& first = tiles[tz * tilesX + tx];
+                const LavaTile& last = tiles[tz * tilesX + runEnd];
+                for (int z = first.rowBegin; z < first.rowEnd; ++z) {
+                    size_t offset = size_t(z) * cols + first.colBegin;
+                    size_t count = size_t(last.colEnd - first.colBegin);
+                    glBindBuffer(GL_ARRAY_BUFFER, lava.mVBOs[0]);
+                    glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(glm::vec3), count * sizeof(glm::vec3), &source.mVertices[offset]);
+                    glBindBuffer(GL_ARRAY_BUFFER, lava.mVBOs[1]);
+                    glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(glm::vec3), count * sizeof(glm::vec3), &source.mNormals[offset]);
+                }
+                for (int i = tx; i <= runEnd; ++i)
+                    tiles[tz * tilesX + i].dirty = false;
+                tx = runEnd;
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // draw the visible tiles, the lava VAO and shader must be bound
+    void draw(const ModelData& lava) const {
+        if (lava.mPrimitive == GL_TRIANGLE_STRIP)
+        {
+            glEnable(GL_PRIMITIVE_RESTART);
+            glPrimitiveRestartIndex(lava.RestartIndex());
+        }
+        for (const LavaTile& tile : tiles) {
+            if (!tile.visible)
+                continue;
+            glDrawElements(lava.mPrimitive, static_cast<GLsizei>(tile.indexCount), lava.mIndexType, (void*)(tile.indexOffset * lava.IndexSize()));
+        }
+        glDisable(GL_PRIMITIVE_RESTART);
+    }
+};
+
+LavaTiles lavaTiles;
@@ -0,0 +1,166 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <iostream>
+#include <glm.hpp>
+
+#include "ModelStructure.h"
+#include "LavaTiles.h"
+
+// Lava heights for the next frame computed on a dedicated thread while the current frame renders.
+// Two surface buffers: the main thread uploads from the front one while the worker fills the back
+// one. The hand off is a single atomic flag, and the buffers are swapped at the frame boundary only
+// when the worker is idle, so neither side ever waits on the other. Only turning the worker off and
+// Shutdown wait for the job in flight.
+class LavaWorker {
+
+private:
+    // one lava surface plus the job that produced it
+    struct LavaFrame {
+        ModelData surface;                // only mVertices and mNormals are used
+        std::vector<char> tileRequested;  // tiles to compute, chosen by the main thread
+        float time = 0.0f;
+        int updatedCount = 0;
+    };
+
+    LavaFrame frames[2];
+    int back = 0;                       // frame owned by the worker while busy, the other one is uploaded
+    bool hasResult = false;             // back holds a job that has not been uploaded yet
+    std::atomic<bool> busy{ false };
+    LavaHeightField field;              // the worker's own kernel, lavaHeightField stays with the main thread
+
+    std::thread worker;
+    std::mutex mutex;                   // only used to sleep between jobs and to wait for the last one
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool stopping = false;              // guarded by mutex, the worker exits once it is idle
+    float lastTime = -1.0f;             // time of the last job started, negative before the first one
+
+    LavaWorker() {}
+
+    LavaWorker(const LavaWorker&) = delete;
+    LavaWorker& operator=(const LavaWorker&) = delete;
+
+    void workerLoop() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || busy.load(std::memory_order_acquire); });
+                if (!busy.load(std::memory_order_acquire))
+                    return;
+            }
+            compute(frames[back]);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy.store(false, std::memory_order_release);
+            }
+            idle.notify_all();
+        }
+    }
+
+    void waitIdle() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return !busy.load(std::memory_order_acquire); });
+    }
+
+    void compute(LavaFrame& frame) {
+        frame.updatedCount = 0;
+        field.buildTables(frame.time);
+        for (size_t i = 0; i < lavaTiles.tiles.size(); ++i) {
+            if (!frame.tileRequested[i])
+                continue;
+            const LavaTile& tile = lavaTiles.tiles[i];
+            field.fillBlock(tile.rowBegin, tile.rowEnd, tile.colBegin, tile.colEnd);
+            field.writeBlock(frame.surface, tile.rowBegin, tile.rowEnd, tile.colBegin, tile.colEnd);
+            ++frame.updatedCount;
+        }
+    }
+
+public:
+    static LavaWorker* Instance()
+    {
+        static LavaWorker* instance = new LavaWorker();
+        return instance;
+    }
+
+    bool enabled = true;
+    const float MAX_LOOKAHEAD = 0.1f;   // a stall or a slow job does not push the lava seconds ahead
+
+
+    // call after lavaTiles.build
+    void Init(const ModelData& lava) {
+        field.waves = lavaHeightField.waves;
+        field.init(lavaTiles.rows, lavaTiles.cols, lava.mVertices);
+        for (LavaFrame& frame : frames) {
+            frame.surface.mVertices = lava.mVertices;
+            frame.surface.mNormals = lava.mNormals;
+            frame.tileRequested.assign(lavaTiles.tiles.size(), 0);
+        }
+        lastTime = -1.0f;
+        stopping = false;
+        worker = std::thread([this] { workerLoop(); });
+    }
+
+    // finish the job in flight and join the worker, before the lava tiles it reads are destroyed
+    void Shutdown() {
+        if (!worker.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    // wait for the job in flight, the synchronous path can then use the lava buffers again
+    void setEnabled(bool value) {
+        waitIdle();
+        hasResult = false;
+        lastTime = -1.0f;
+        enabled = value;
+        std::cout << "Lava update: " << (enabled ? "worker thread" : "main thread") << std::endl;
+    }
+
+    // Frame boundary: start the next surface on the worker, then upload the one it just finished.
+    // Never waits, if the worker is still busy the lava keeps its current surface for another frame.
+    void update(ModelData& lava, float time, const glm::vec3& camera) {
+        if (busy.load(std::memory_order_acquire))
+            return;
+
+        // swap, the finished back buffer becomes the front one
+        int front = back;
+        bool uploadFront = hasResult;
+        back = 1 - back;
+
+        // the next job targets the next frame, assuming it takes as long as the last one
+        float frameTime = lastTime < 0.0f ? 0.0f : glm::clamp(time - lastTime, 0.0f, MAX_LOOKAHEAD);
+        lastTime = time;
+        LavaFrame& next = frames[back];
+        next.time = time + frameTime;
+        for (size_t i = 0; i < lavaTiles.tiles.size(); ++i) {
+            next.tileRequested[i] = lavaTiles.isDue(lavaTiles.tiles[i], next.time, camera);
+            if (next.tileRequested[i])
+                lavaTiles.tiles[i].lastUpdate = next.time;
+        }
+        hasResult = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy.store(true, std::memory_order_release);
+        }
+        wake.notify_one();
+
+        if (uploadFront) {
+            const LavaFrame& finished = frames[front];
+            for (size_t i = 0; i < lavaTiles.tiles.size(); ++i) {
+                if (finished.tileRequested[i])
+                    lavaTiles.tiles[i].dirty = true;
+            }
+            lavaTiles.updatedCount = finished.updatedCount;
+            lavaTiles.upload(lava, finished.surface);
+        }
+    }
+};
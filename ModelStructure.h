@@ -4,6 +4,7 @@
 
 enum Type { STATIC, CRAB, FISH, LAVA };
 
+// circling fish, the orbit component of ActorWorld.h
 struct FishInstance {
 	float angle = 0.f;        // Current angle along the circular path
 	float speed = 0.f;        // Speed of this fish
@@ -18,71 +19,49 @@ struct ModelData
 	GLuint mVao = 0;
 	GLuint mVBOs[3] = {0,0,0};
 	GLuint mEBO = 0;
-	GLuint instanceVBO;
+	GLuint instanceVBO = 0;                    // CompactTransforms, see ActorWorld::enableInstancing
 	vector<glm::vec3> mVertices;
 	vector<glm::vec3> mNormals;
 	vector<glm::vec4> mColors;
 	vector<glm::vec2> mTextureCoords;
 	vector<unsigned int> mIndices;
-	glm::mat4 mLocalTransform;
+	vector<unsigned short> mIndices16;          // used instead of mIndices when mIndexType is GL_UNSIGNED_SHORT
+	GLenum mIndexType = GL_UNSIGNED_INT;
+	GLenum mPrimitive = GL_TRIANGLES;           // GL_TRIANGLE_STRIP uses primitive restart
+	glm::mat4 mLocalTransform = glm::mat4(1.0f); // to the parent mesh, meshes loaded flat are already in model space
 
 	string mTexturePath;
 	GLuint mTextureId;
 
 	vector<ModelData> mChildMeshes;
-};
-
-struct Crab
-{
-	ModelData model;           // The crab's model data
-	float radius = 3.f;              // Used for collision detection
-	glm::vec3 translation;     // Current translation from the origin(0,0,0)
-	glm::vec3 velocity;        // Current speed and direction
-	glm::vec3 rotation;        // Current rotation (X, Y, Z)
-	bool runAway = false;
-	float runAwayTime = 0.f;
-	Crab() : translation(0.f), rotation(0.0), velocity(5.0f, 0.f, 5.0f){}
 
-	glm::vec3 CurrentPosition() const
+	size_t IndexCount() const
 	{
-		// Transform the origin (0, 0, 0) using the model matrix
-		glm::vec4 worldPosition = GetModelTransform() * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-		return glm::vec3(worldPosition);
+		return mIndexType == GL_UNSIGNED_SHORT ? mIndices16.size() : mIndices.size();
 	}
 
-	glm::mat4 GetModelTransform() const
+	const void* IndexData() const
 	{
-		// Apply rotation (around the local axes, X, Y, Z)
-		glm::mat4 rotationMtx = glm::rotate(glm::mat4(1.0f), rotation.x, glm::vec3(1.0f, 0.0f, 0.0f)); // Rotate around X-axis
-		rotationMtx = glm::rotate(rotationMtx, rotation.y, glm::vec3(0.0f, 1.0f, 0.0f)); // Rotate around Y-axis
-		rotationMtx = glm::rotate(rotationMtx, rotation.z, glm::vec3(0.0f, 0.0f, 1.0f)); // Rotate around Z-axis
-
-		// Apply translation
-		glm::mat4 translationMtx = glm::translate(glm::mat4(1.0f), translation);
+		return mIndexType == GL_UNSIGNED_SHORT ? static_cast<const void*>(mIndices16.data()) : static_cast<const void*>(mIndices.data());
+	}
 
-		return translationMtx * rotationMtx;
+	size_t IndexSize() const
+	{
+		return mIndexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
 	}
 
-	void StartRun()
+	GLuint RestartIndex() const
 	{
-		runAway = true;
-		runAwayTime = RUNAWAYTIME;
-		//rotationAngle = (((rand()) % 100) * glm::pi<float>()) - 0.5 * glm::pi<float>();
+		return mIndexType == GL_UNSIGNED_SHORT ? 0xFFFF : 0xFFFFFFFF;
 	}
 };
 
 vector<ModelData> staticModels;
-vector<Crab> CrabModels;
-ModelData fishModel;
-
-// fish hierarchical mesh rotation for each fish part
-GLfloat rotate_head = 0.0f, rotate_fin = 0.0f, rotate_body = 0.f;
 
-// whole translation for each fish model
-vector<glm::mat4> fish_transforms;
-vector<glm::vec3> fish_centers;
-vector<FishInstance> fishInstances;
-vector<glm::mat4> fishInstanceTransforms;
+// circling fish moved by the vertex shader: per instance (angle at time 0, speed, radius, y),
+// uploaded when the mode is switched on instead of a transform every frame
+bool fishOnGPU = false;
+vector<glm::vec4> fishOrbits;
 ModelData lavaModel;
 glm::vec3 lavaPosition = glm::vec3(10.0f, 3.0f, 0.0f);
 float lavaWidth = 150.0f; 
@@ -0,0 +1,153 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <GL/glew.h>
+#include <glm.hpp>
+
+#include "CameraControl.hpp"
+#include "ScreenPass.h"
+#include "ShaderUtility.h"
+
+// Draws the smoke into a half or quarter resolution target instead of the backbuffer. Particles are
+// depth tested against a downsampled copy of the scene depth, then composited back with a
+// nearest-depth upsample so the smoke keeps sharp edges against the volcano and rocks.
+class OffscreenParticlePass {
+
+private:
+    OffscreenParticlePass() {}
+
+    OffscreenParticlePass(const OffscreenParticlePass&) = delete;
+    OffscreenParticlePass& operator=(const OffscreenParticlePass&) = delete;
+public:
+
+    static OffscreenParticlePass* Instance()
+    {
+        static OffscreenParticlePass* instance = new OffscreenParticlePass();
+        return instance;
+    }
+
+    int divisor = 1; // 1 = straight into the backbuffer, 2 = half, 4 = quarter resolution
+    int targetWidth = 0, targetHeight = 0;
+    GLuint framebuffer = 0;
+    GLuint colorTexture = 0;  // rgb = premultiplied smoke colour, a = transmittance
+    GLuint depthTexture = 0;  // downsampled scene depth
+    GLuint downsampleProgram, compositeProgram;
+    float savedClearColor[4];
+
+
+    void Init() {
+        screenPass::Init();
+        downsampleProgram = createShaderProgram("screenVertexShader.txt", "depthDownsampleFragmentShader.txt");
+        compositeProgram = createShaderProgram("screenVertexShader.txt", "particleCompositeFragmentShader.txt");
+
+        glGenFramebuffers(1, &framebuffer);
+        glGenTextures(1, &colorTexture);
+        glGenTextures(1, &depthTexture);
+    }
+
+    void setDivisor(int value) {
+        divisor = value;
+        if (divisor > 1)
+        {
+            resizeTargets();
+        }
+        std::cout << "Particle resolution: 1/" << divisor << std::endl;
+    }
+
+    void resizeTargets() {
+        targetWidth = std::max(width / divisor, 1);
+        targetHeight = std::max(height / divisor, 1);
+
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, targetWidth, targetHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, targetWidth, targetHeight, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cerr << "Offscreen particle framebuffer is incomplete, drawing at full resolution" << std::endl;
+            divisor = 1;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Redirect the particle draw into the low resolution target, call after the opaque pass
+    void begin() {
+        GLuint sceneDepth = screenPass::CopySceneDepth();
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, targetWidth, targetHeight);
+
+        // keep the farthest scene depth of each block, so no particle visible at full resolution is rejected
+        glUseProgram(downsampleProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, sceneDepth);
+        glUniform1i(glGetUniformLocation(downsampleProgram, "sceneDepth"), 0);
+        glUniform1i(glGetUniformLocation(downsampleProgram, "divisor"), divisor);
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthFunc(GL_ALWAYS);
+        glDisable(GL_BLEND);
+        screenPass::Draw();
+        glEnable(GL_BLEND);
+        glDepthFunc(GL_LESS);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // no smoke yet: black, fully transmissive
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, savedClearColor);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glClearColor(savedClearColor[0], savedClearColor[1], savedClearColor[2], savedClearColor[3]);
+
+        // same "over" blending for colour, alpha keeps the product of (1 - alpha)
+        glDepthMask(GL_FALSE);
+        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    // Upsample the smoke over the backbuffer
+    void end() {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, width, height);
+        glDepthMask(GL_TRUE);
+
+        glUseProgram(compositeProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        glUniform1i(glGetUniformLocation(compositeProgram, "particleColor"), 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glUniform1i(glGetUniformLocation(compositeProgram, "lowResDepth"), 1);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, screenPass::sceneDepthTexture);
+        glUniform1i(glGetUniformLocation(compositeProgram, "sceneDepth"), 2);
+        glUniform1f(glGetUniformLocation(compositeProgram, "nearPlane"), nearPlane);
+        glUniform1f(glGetUniformLocation(compositeProgram, "farPlane"), farPlane);
+
+        // scene * transmittance + smoke
+        glDisable(GL_DEPTH_TEST);
+        glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+        screenPass::Draw();
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glEnable(GL_DEPTH_TEST);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
@@ -1,5 +1,8 @@
 #pragma once
 #include <random>
+#include <algorithm>
+#include <cstddef>
+#include <cmath>
 #include <GL/glew.h>
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
@@ -10,11 +13,15 @@
 #include "CameraControl.hpp"
 #include "TextureManager.h"
 #include "ShaderUtility.h"
+#include "OffscreenParticlePass.h"
+#include "WeightedOIT.h"
+#include "FogLayers.h"
 
 // Random number generator for particles
 std::mt19937 rng(std::random_device{}());
 std::uniform_real_distribution<float> horizontalDist(-5.f, 5.f); // Small horizontal spread
 std::uniform_real_distribution<float> verticalDist(12.f, 25.f);    // Upward velocity
+std::uniform_real_distribution<float> seedDist(0.f, 1.f);          // Per particle seed for shader side jitter
 
 
 // Particle structure
@@ -25,6 +32,30 @@ struct Particle {
     Particle() : position(0.0f), velocity(0.0f), lifetime(0.0f) {}
 };
 
+// Particle state as stored in the transform feedback buffers
+struct GpuParticle {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    float lifetime;
+    float lifetimePercent; // negative when the particle is dead, so the draw pass can drop it
+};
+
+// Spawn record for the analytic backend, written once when a particle is born
+struct AnalyticParticle {
+    glm::vec3 spawnPosition;
+    glm::vec3 velocity;
+    float spawnTime;
+    float seed;
+};
+
+// Where particle simulation runs
+enum ParticleBackend { CPU_BACKEND, TRANSFORM_FEEDBACK_BACKEND, ANALYTIC_BACKEND };
+inline constexpr const char* ParticleBackendNames[] = { "CPU", "transform feedback", "analytic" };
+
+// How overlapping smoke is blended
+enum TransparencyMode { UNSORTED_BLEND, SORTED_BLEND, WEIGHTED_OIT };
+inline constexpr const char* TransparencyModeNames[] = { "unsorted blending", "sorted blending", "weighted blended OIT" };
+
 class ParticleSystem {
 
 private:
@@ -42,7 +73,10 @@ public:
 
     const int NUM_PARTICLES = 3500;
     const float PARTICLE_LIFETIME = 7.0f;
+    const float DAMPING_FACTOR = 0.75f; // Slow down speed
+    static constexpr int MAX_SPAWN_PER_FRAME = 64; // size of spawnSlots[] in particleUpdateVertexShader.txt
     std::vector<Particle> particles;
+    int particleIndex = 0; // track which particle to reset
 
 
     GLuint particleVAO, particleVBO, offsetVBO, lifeTimeVBO;
@@ -50,10 +84,30 @@ public:
     GLuint particleTexture;
     glm::vec3 startPosition{ 4.3, 40, -0.5 }; // crater of the volcano
 
+    // transform feedback backend: particle state ping-pongs between two buffers
+    ParticleBackend backend = CPU_BACKEND;
+    TransparencyMode transparency = UNSORTED_BLEND;
+    GLuint updateProgram;
+    GLuint stateVBO[2], updateVAO[2], stateDrawVAO[2];
+    int currentState = 0; // buffer holding the latest particle state
+    unsigned int frameSeed = 0;
+
+    // analytic backend: only spawns are uploaded, the vertex shader evaluates the motion from time
+    GLuint analyticVBO, analyticVAO;
+    std::vector<AnalyticParticle> analyticState; // copy of analyticVBO, written together with it
+    std::vector<float> spawnTimes; // enough to find dead particles without touching the GPU
+    float simulationTime = 0.0f;
+    float lastDeltaTime = 0.01f;
+
 
     void Init() {
 		initParticles();
 		initOpenGL();
+		initTransformFeedback();
+		initAnalytic();
+		OffscreenParticlePass::Instance()->Init();
+		WeightedOIT::Instance()->Init();
+		FogLayers::Instance()->Init();
 	}
 
     // Initialize particles
@@ -62,44 +116,95 @@ public:
         for (int i = 0; i < NUM_PARTICLES; ++i) {
             particles.emplace_back();
         }
+        // born one lifetime ago, so every particle starts dead
+        spawnTimes.assign(NUM_PARTICLES, -PARTICLE_LIFETIME);
     }
 
 
-    void updateParticles(float deltaTime, int NewParticlePerFrame) {
-        // track which particle to reset
-        static int particleIndex = 0; 
-        int searched = 0;
-        for (int i = 0; i < NewParticlePerFrame; ++i) {
+    // The transform feedback state only lives on the GPU, the other backends can be read on the CPU
+    bool cpuReadable() const { return backend != TRANSFORM_FEEDBACK_BACKEND; }
+
+    // Position and lifetime percent of particle i if it is alive, only while cpuReadable(). The analytic
+    // motion is evaluated like the vertex shader, drift included.
+    bool liveParticle(int i, glm::vec3& position, float& lifetimePercent) const {
+        if (backend == ANALYTIC_BACKEND)
+        {
+            const AnalyticParticle& p = analyticState[i];
+            float age = simulationTime - p.spawnTime;
+            if (age >= PARTICLE_LIFETIME) return false;
+            float driftAngle = p.seed * 6.2831853f;
+            glm::vec2 drift = glm::vec2(std::cos(driftAngle), std::sin(driftAngle)) * jitterScale() * std::pow(std::max(age, 0.0f), 1.5f);
+            position = p.spawnPosition + p.velocity * DAMPING_FACTOR * age + glm::vec3(drift.x, 0.0f, drift.y);
+            lifetimePercent = age / PARTICLE_LIFETIME;
+            return true;
+        }
+        const Particle& p = particles[i];
+        if (p.lifetime <= 0.0f) return false;
+        position = p.position;
+        lifetimePercent = (PARTICLE_LIFETIME - p.lifetime) / PARTICLE_LIFETIME;
+        return true;
+    }
+
+    bool isAlive(int i) const {
+        if (backend == ANALYTIC_BACKEND)
+        {
+            return simulationTime - spawnTimes[i] < PARTICLE_LIFETIME;
+        }
+        return particles[i].lifetime > 0.0f;
+    }
 
-            searched++;
-            // if particle is still alive, skip and --i to try again
-            if (particles[particleIndex].lifetime > 0.0f)
+    // Walk the ring from particleIndex and collect up to count dead particles to respawn.
+    // Both backends share this, so they respawn into exactly the same slots.
+    int findDeadParticles(int count, int* slots) {
+        int found = 0;
+        int searched = 0;
+        while (found < count) {
+            // every particle has been visited once, the rest are still alive
+            if (searched++ >= NUM_PARTICLES)
             {
-                if (searched > NUM_PARTICLES)
-                {
-                    std::cout << "No more particles to reset" << std::endl;
-                    break;
-                }
-                --i;
-                particleIndex = (particleIndex + 1) % NUM_PARTICLES; 
-                continue;
+                std::cout << "No more particles to reset" << std::endl;
+                break;
             }
-
-            // particle is dead, reset it
-            if (particles[particleIndex].lifetime <= 0.0f)
+            if (!isAlive(particleIndex))
             {
-                // Reset a particle
-                Particle& p = particles[particleIndex];
-                // start from crater of the volcano
-                p.position = startPosition + glm::vec3(horizontalDist(rng), 0.0f, horizontalDist(rng));
-                p.velocity = glm::vec3(horizontalDist(rng), verticalDist(rng), horizontalDist(rng)); // Mostly upward velocity
-                p.lifetime = PARTICLE_LIFETIME;
+                slots[found++] = particleIndex;
             }
             particleIndex = (particleIndex + 1) % NUM_PARTICLES;
         }
+        return found;
+    }
+
+    void updateParticles(float deltaTime, int NewParticlePerFrame) {
+        int spawnSlots[MAX_SPAWN_PER_FRAME];
+        int spawnCount = findDeadParticles(std::min(NewParticlePerFrame, MAX_SPAWN_PER_FRAME), spawnSlots);
+
+        switch (backend)
+        {
+        case TRANSFORM_FEEDBACK_BACKEND:
+            updateParticlesGPU(deltaTime, spawnSlots, spawnCount);
+            break;
+        case ANALYTIC_BACKEND:
+            spawnParticlesAnalytic(spawnSlots, spawnCount);
+            break;
+        default:
+            updateParticlesCPU(deltaTime, spawnSlots, spawnCount);
+            break;
+        }
+        simulationTime += deltaTime;
+        lastDeltaTime = deltaTime;
+    }
+
+    void updateParticlesCPU(float deltaTime, const int* spawnSlots, int spawnCount) {
+        // particle is dead, reset it
+        for (int i = 0; i < spawnCount; ++i) {
+            Particle& p = particles[spawnSlots[i]];
+            // start from crater of the volcano
+            p.position = startPosition + glm::vec3(horizontalDist(rng), 0.0f, horizontalDist(rng));
+            p.velocity = glm::vec3(horizontalDist(rng), verticalDist(rng), horizontalDist(rng)); // Mostly upward velocity
+            p.lifetime = PARTICLE_LIFETIME;
+        }
 
         // Update all particles
-        const float dampingFactor = 0.75f; // Slow down speed
         for (auto& p : particles) {
             if (p.lifetime > 0.0f) {
 
@@ -109,10 +214,139 @@ public:
                 p.velocity.x += randomX;
                 p.velocity.z += randomZ;
 
-                p.position += p.velocity * deltaTime * dampingFactor;
+                p.position += p.velocity * deltaTime * DAMPING_FACTOR;
+                p.lifetime -= deltaTime;
+            }
+        }
+    }
+
+    // Advance all particles on the GPU. Only the spawn slot indices are uploaded.
+    void updateParticlesGPU(float deltaTime, const int* spawnSlots, int spawnCount) {
+        // Keep the CPU lifetimes in step with the GPU so findDeadParticles sees the same state.
+        // Lifetime is deterministic, so this needs no read back.
+        for (int i = 0; i < spawnCount; ++i) {
+            particles[spawnSlots[i]].lifetime = PARTICLE_LIFETIME;
+        }
+        for (auto& p : particles) {
+            if (p.lifetime > 0.0f) {
                 p.lifetime -= deltaTime;
             }
         }
+
+        glUseProgram(updateProgram);
+        glUniform1f(glGetUniformLocation(updateProgram, "deltaTime"), deltaTime);
+        glUniform1f(glGetUniformLocation(updateProgram, "particleLifetime"), PARTICLE_LIFETIME);
+        glUniform1f(glGetUniformLocation(updateProgram, "dampingFactor"), DAMPING_FACTOR);
+        glUniform3fv(glGetUniformLocation(updateProgram, "startPosition"), 1, glm::value_ptr(startPosition));
+        glUniform1ui(glGetUniformLocation(updateProgram, "frameSeed"), frameSeed++);
+        glUniform1i(glGetUniformLocation(updateProgram, "spawnCount"), spawnCount);
+        if (spawnCount > 0)
+        {
+            glUniform1iv(glGetUniformLocation(updateProgram, "spawnSlots"), spawnCount, spawnSlots);
+        }
+
+        // read from the current state and write the next one, nothing is rasterized
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(updateVAO[currentState]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, stateVBO[1 - currentState]);
+
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, NUM_PARTICLES);
+        glEndTransformFeedback();
+
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindVertexArray(0);
+        glDisable(GL_RASTERIZER_DISCARD);
+
+        currentState = 1 - currentState;
+    }
+
+    // Write spawn records for the new particles only, nothing else is uploaded per frame
+    void spawnParticlesAnalytic(const int* spawnSlots, int spawnCount) {
+        glBindBuffer(GL_ARRAY_BUFFER, analyticVBO);
+        for (int i = 0; i < spawnCount; ++i) {
+            AnalyticParticle p;
+            // start from crater of the volcano
+            p.spawnPosition = startPosition + glm::vec3(horizontalDist(rng), 0.0f, horizontalDist(rng));
+            p.velocity = glm::vec3(horizontalDist(rng), verticalDist(rng), horizontalDist(rng)); // Mostly upward velocity
+            p.spawnTime = simulationTime;
+            p.seed = seedDist(rng);
+            spawnTimes[spawnSlots[i]] = simulationTime;
+            analyticState[spawnSlots[i]] = p;
+            glBufferSubData(GL_ARRAY_BUFFER, spawnSlots[i] * sizeof(AnalyticParticle), sizeof(AnalyticParticle), &p);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Copy the state of the active backend into particles
+    void pullState() {
+        if (backend == TRANSFORM_FEEDBACK_BACKEND)
+        {
+            std::vector<GpuParticle> state(NUM_PARTICLES);
+            glBindBuffer(GL_ARRAY_BUFFER, stateVBO[currentState]);
+            glGetBufferSubData(GL_ARRAY_BUFFER, 0, NUM_PARTICLES * sizeof(GpuParticle), state.data());
+            for (int i = 0; i < NUM_PARTICLES; ++i) {
+                particles[i].position = state[i].position;
+                particles[i].velocity = state[i].velocity;
+                particles[i].lifetime = state[i].lifetime;
+            }
+        }
+        else if (backend == ANALYTIC_BACKEND)
+        {
+            // evaluate the motion like the vertex shader, minus the sub-unit jitter drift
+            const std::vector<AnalyticParticle>& state = analyticState;
+            for (int i = 0; i < NUM_PARTICLES; ++i) {
+                float age = simulationTime - state[i].spawnTime;
+                particles[i].position = state[i].spawnPosition + state[i].velocity * DAMPING_FACTOR * age;
+                particles[i].velocity = state[i].velocity;
+                particles[i].lifetime = isAlive(i) ? PARTICLE_LIFETIME - age : 0.0f;
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Hand particles over to the active backend
+    void pushState() {
+        if (backend == TRANSFORM_FEEDBACK_BACKEND)
+        {
+            std::vector<GpuParticle> state(NUM_PARTICLES);
+            for (int i = 0; i < NUM_PARTICLES; ++i) {
+                const Particle& p = particles[i];
+                state[i].position = p.position;
+                state[i].velocity = p.velocity;
+                state[i].lifetime = p.lifetime;
+                state[i].lifetimePercent = p.lifetime > 0.0f ? (PARTICLE_LIFETIME - p.lifetime) / PARTICLE_LIFETIME : -1.0f;
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, stateVBO[currentState]);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, NUM_PARTICLES * sizeof(GpuParticle), state.data());
+        }
+        else if (backend == ANALYTIC_BACKEND)
+        {
+            // rewind each live particle to where it would have spawned
+            std::vector<AnalyticParticle>& state = analyticState;
+            for (int i = 0; i < NUM_PARTICLES; ++i) {
+                const Particle& p = particles[i];
+                float age = p.lifetime > 0.0f ? PARTICLE_LIFETIME - p.lifetime : PARTICLE_LIFETIME;
+                state[i].spawnPosition = p.position - p.velocity * DAMPING_FACTOR * age;
+                state[i].velocity = p.velocity;
+                state[i].spawnTime = simulationTime - age;
+                state[i].seed = seedDist(rng);
+                spawnTimes[i] = state[i].spawnTime;
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, analyticVBO);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, NUM_PARTICLES * sizeof(AnalyticParticle), state.data());
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Switch simulation backend, handing the particle state over once so the smoke carries on seamlessly
+    void setBackend(ParticleBackend newBackend) {
+        if (newBackend == backend) return;
+
+        pullState();
+        backend = newBackend;
+        pushState();
+        std::cout << "Particle backend: " << ParticleBackendNames[backend] << std::endl;
     }
 
     void initOpenGL() {
@@ -171,40 +405,209 @@ public:
 
         
         // load and compile particle shader
-        const char* vertexSource = readShaderSource("particleVertexSharder.txt");
-        const char* fragmentSource = readShaderSource("particleFragmentShader.txt");
+        shaderProgram = createShaderProgram("particleVertexSharder.txt", "particleFragmentShader.txt");
+    }
 
-        GLuint vertexShader = compileShader(vertexSource, GL_VERTEX_SHADER);
-        GLuint fragmentShader = compileShader(fragmentSource, GL_FRAGMENT_SHADER);
+    void initTransformFeedback() {
+        // update program: vertex stage only, outputs captured into the other state buffer
+        const char* updateSource = readShaderSource("particleUpdateVertexShader.txt");
+        GLuint updateShader = compileShader(updateSource, GL_VERTEX_SHADER);
 
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        glLinkProgram(shaderProgram);
+        updateProgram = glCreateProgram();
+        glAttachShader(updateProgram, updateShader);
+        const char* varyings[] = { "outPosition", "outVelocity", "outLifetime", "outLifetimePercent" };
+        glTransformFeedbackVaryings(updateProgram, 4, varyings, GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(updateProgram);
 
         GLint success;
-        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+        glGetProgramiv(updateProgram, GL_LINK_STATUS, &success);
         if (!success) {
             char infoLog[512];
-            glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
+            glGetProgramInfoLog(updateProgram, 512, nullptr, infoLog);
             std::cerr << "Shader Linking Error: " << infoLog << std::endl;
             exit(1);
         }
+        glDeleteShader(updateShader);
+
+        // all particles start dead
+        std::vector<GpuParticle> initialState(NUM_PARTICLES);
+        for (auto& p : initialState) {
+            p.position = glm::vec3(0.0f);
+            p.velocity = glm::vec3(0.0f);
+            p.lifetime = 0.0f;
+            p.lifetimePercent = -1.0f;
+        }
+
+        glGenBuffers(2, stateVBO);
+        glGenVertexArrays(2, updateVAO);
+        glGenVertexArrays(2, stateDrawVAO);
+        for (int i = 0; i < 2; ++i) {
+            glBindBuffer(GL_ARRAY_BUFFER, stateVBO[i]);
+            glBufferData(GL_ARRAY_BUFFER, NUM_PARTICLES * sizeof(GpuParticle), initialState.data(), GL_DYNAMIC_COPY);
+
+            // VAO read by the update pass
+            glBindVertexArray(updateVAO[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, stateVBO[i]);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*)offsetof(GpuParticle, position));
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*)offsetof(GpuParticle, velocity));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*)offsetof(GpuParticle, lifetime));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*)offsetof(GpuParticle, lifetimePercent));
+            glEnableVertexAttribArray(3);
+
+            // VAO for drawing: same quad as particleVAO, instance data straight from the state buffer
+            glBindVertexArray(stateDrawVAO[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+            glEnableVertexAttribArray(2);
+
+            glBindBuffer(GL_ARRAY_BUFFER, stateVBO[i]);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*)offsetof(GpuParticle, position));
+            glEnableVertexAttribArray(1);
+            glVertexAttribDivisor(1, 1);
+            glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*)offsetof(GpuParticle, lifetimePercent));
+            glEnableVertexAttribArray(3);
+            glVertexAttribDivisor(3, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void initAnalytic() {
+        analyticState.resize(NUM_PARTICLES);
+        for (int i = 0; i < NUM_PARTICLES; ++i) {
+            analyticState[i].spawnPosition = startPosition;
+            analyticState[i].velocity = glm::vec3(0.0f);
+            analyticState[i].spawnTime = spawnTimes[i];
+            analyticState[i].seed = 0.0f;
+        }
+
+        glGenBuffers(1, &analyticVBO);
+        glGenVertexArrays(1, &analyticVAO);
+        glBindVertexArray(analyticVAO);
+
+        // same quad as particleVAO
+        glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(2);
+
+        // spawn records, one per particle slot
+        glBindBuffer(GL_ARRAY_BUFFER, analyticVBO);
+        glBufferData(GL_ARRAY_BUFFER, NUM_PARTICLES * sizeof(AnalyticParticle), analyticState.data(), GL_DYNAMIC_DRAW);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(AnalyticParticle), (void*)offsetof(AnalyticParticle, spawnPosition));
+        glEnableVertexAttribArray(1);
+        glVertexAttribDivisor(1, 1);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(AnalyticParticle), (void*)offsetof(AnalyticParticle, velocity));
+        glEnableVertexAttribArray(4);
+        glVertexAttribDivisor(4, 1);
+        glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(AnalyticParticle), (void*)offsetof(AnalyticParticle, spawnTime));
+        glEnableVertexAttribArray(5);
+        glVertexAttribDivisor(5, 1);
 
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void setRenderUniforms() {
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(persp_proj));
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniform4f(glGetUniformLocation(shaderProgram, "particleColor"), 1.0f, 1.0f, 1.0f, 1.0f);
+        glUniform1i(glGetUniformLocation(shaderProgram, "weightedOIT"), transparency == WEIGHTED_OIT);
+
+        // analytic motion
+        glUniform1i(glGetUniformLocation(shaderProgram, "analyticMotion"), backend == ANALYTIC_BACKEND);
+        glUniform1f(glGetUniformLocation(shaderProgram, "time"), simulationTime);
+        glUniform1f(glGetUniformLocation(shaderProgram, "particleLifetime"), PARTICLE_LIFETIME);
+        glUniform1f(glGetUniformLocation(shaderProgram, "dampingFactor"), DAMPING_FACTOR);
+        glUniform1f(glGetUniformLocation(shaderProgram, "jitterScale"), jitterScale());
+
+        // Bind texture
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, particleTexture);
+        glUniform1i(glGetUniformLocation(shaderProgram, "particleTexture"), 0);
+    }
+
+    // The CPU velocity jitter is a random walk of uniform steps in +-0.005 per update, so the spread
+    // of the position it causes grows with age^1.5. This is the matching scale for the shader.
+    float jitterScale() const {
+        const float stepDeviation = 0.01f / std::sqrt(12.0f);
+        return DAMPING_FACTOR * stepDeviation / std::sqrt(3.0f * lastDeltaTime);
+    }
+
+    void setTransparency(TransparencyMode mode) {
+        transparency = mode;
+        std::cout << "Smoke transparency: " << TransparencyModeNames[transparency];
+        if (transparency == SORTED_BLEND && backend != CPU_BACKEND)
+        {
+            std::cout << " (only the CPU backend sorts)";
+        }
+        std::cout << std::endl;
     }
 
     void renderParticles() {
+        OffscreenParticlePass* offscreen = OffscreenParticlePass::Instance();
+        if (transparency == WEIGHTED_OIT)
+        {
+            // sort free, resolved at full resolution, with the fog sheets in between the smoke
+            WeightedOIT::Instance()->begin();
+            drawParticles();
+            FogLayers::Instance()->draw();
+            WeightedOIT::Instance()->end();
+        }
+        else if (offscreen->divisor > 1)
+        {
+            offscreen->begin();
+            drawParticles();
+            offscreen->end();
+        }
+        else
+        {
+            drawParticles();
+        }
+    }
+
+    void drawParticles() {
+
+        if (backend != CPU_BACKEND)
+        {
+            // state never leaves the GPU, dead particles are dropped in the vertex shader
+            glUseProgram(shaderProgram);
+            glBindVertexArray(backend == ANALYTIC_BACKEND ? analyticVAO : stateDrawVAO[currentState]);
+            setRenderUniforms();
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 6, NUM_PARTICLES);
+            glBindVertexArray(0);
+            return;
+        }
 
         // only render alive particles
+        std::vector<int> drawOrder;
+        for (int i = 0; i < NUM_PARTICLES; ++i) {
+            if (particles[i].lifetime > 0.0f) {
+                drawOrder.push_back(i);
+            }
+        }
+
+        // back to front for correct "over" blending
+        if (transparency == SORTED_BLEND)
+        {
+            std::sort(drawOrder.begin(), drawOrder.end(), [&](int a, int b) {
+                glm::vec3 toA = particles[a].position - cameraPosition;
+                glm::vec3 toB = particles[b].position - cameraPosition;
+                return glm::dot(toA, toA) > glm::dot(toB, toB);
+            });
+        }
+
         std::vector<glm::vec3> offsets;
         std::vector<float> lifeTimes;
-        for (const auto& p : particles) {
-            if (p.lifetime > 0.0f) {
-                offsets.push_back(p.position);
-                lifeTimes.push_back((PARTICLE_LIFETIME - p.lifetime)/ PARTICLE_LIFETIME);
-            }
+        for (int i : drawOrder) {
+            offsets.push_back(particles[i].position);
+            lifeTimes.push_back((PARTICLE_LIFETIME - particles[i].lifetime)/ PARTICLE_LIFETIME);
         }
 
         // No particles to render yet
@@ -230,14 +633,7 @@ public:
         glUnmapBuffer(GL_ARRAY_BUFFER);
 
         // Set uniforms
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(persp_proj));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniform4f(glGetUniformLocation(shaderProgram, "particleColor"), 1.0f, 1.0f, 1.0f, 1.0f);
-
-        // Bind texture
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, particleTexture);
-        glUniform1i(glGetUniformLocation(shaderProgram, "particleTexture"), 0);
+        setRenderUniforms();
 
 
         // Draw instanced particles
@@ -0,0 +1,470 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <utility>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <iostream>
+#include <glm.hpp>
+
+#include "ModelStructure.h"
+#include "ActorWorld.h"
+#include "Benchmark.h"
+
+// Bounding volume hierarchy node in 32 bytes. Children of an inner node are next to each other.
+struct BvhNode {
+    glm::vec3 boundsMin;
+    uint32_t leftFirst;         // first child of an inner node, first primitive slot of a leaf
+    glm::vec3 boundsMax;
+    uint32_t count;             // primitives of a leaf, 0 for an inner node
+};
+
+// Distance along the ray where it enters the box, infinity when it misses it or only enters beyond tMax
+inline float IntersectBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& origin, const glm::vec3& inverseDirection, float tMax) {
+    glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+    glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+    float tNear = std::max(std::max(std::min(t0.x, t1.x), std::min(t0.y, t1.y)), std::min(t0.z, t1.z));
+    float tFar = std::min(std::min(std::max(t0.x, t1.x), std::max(t0.y, t1.y)), std::max(t0.z, t1.z));
+    return tFar >= std::max(tNear, 0.0f) && tNear < tMax ? tNear : std::numeric_limits<float>::infinity();
+}
+
+inline float HalfSurfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    glm::vec3 e = boundsMax - boundsMin;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+// BVH over primitives given by their bounds, split by the surface area heuristic evaluated at BINS
+// planes per axis. order maps the leaf slots to the primitives, so a leaf is a contiguous range.
+struct Bvh {
+    static constexpr int BINS = 12;
+    static constexpr int STACK_SIZE = 64;      // deepest tree, a node this deep is a leaf whatever its size
+
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> order;
+
+    void build(const std::vector<glm::vec3>& primitiveMin, const std::vector<glm::vec3>& primitiveMax, uint32_t maxLeaf) {
+        const uint32_t count = static_cast<uint32_t>(primitiveMin.size());
+        nodes.clear();
+        order.resize(count);
+        if (count == 0) return;
+        std::vector<glm::vec3> centroids(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            order[i] = i;
+            centroids[i] = 0.5f * (primitiveMin[i] + primitiveMax[i]);
+        }
+        nodes.reserve(2 * size_t(count));
+        nodes.push_back({ glm::vec3(0.0f), 0, glm::vec3(0.0f), count });
+
+        // node index and depth
+        std::vector<std::pair<uint32_t, int>> stack = { { 0, 1 } };
+        while (!stack.empty()) {
+            uint32_t index = stack.back().first;
+            int depth = stack.back().second;
+            stack.pop_back();
+            BvhNode node = nodes[index];
+            glm::vec3 boundsMin(std::numeric_limits<float>::max()), boundsMax(-std::numeric_limits<float>::max());
+            glm::vec3 centroidMin = boundsMin, centroidMax = boundsMax;
+            for (uint32_t s = node.leftFirst; s < node.leftFirst + node.count; ++s) {
+                boundsMin = glm::min(boundsMin, primitiveMin[order[s]]);
+                boundsMax = glm::max(boundsMax, primitiveMax[order[s]]);
+                centroidMin = glm::min(centroidMin, centroids[order[s]]);
+                centroidMax = glm::max(centroidMax, centroids[order[s]]);
+            }
+            nodes[index].boundsMin = boundsMin;
+            nodes[index].boundsMax = boundsMax;
+            if (node.count <= maxLeaf || depth >= STACK_SIZE) continue;
+
+            // cheapest plane between bins over the three axes
+            int bestAxis = -1, bestPlane = 0;
+            float bestCost = std::numeric_limits<float>::max();
+            for (int axis = 0; axis < 3; ++axis) {
+                float extent = centroidMax[axis] - centroidMin[axis];
+                if (extent <= 0.0f) continue;
+                float scale = BINS / extent;
+                uint32_t binCount[BINS] = {};
+                glm::vec3 binMin[BINS], binMax[BINS];
+                for (int b = 0; b < BINS; ++b) {
+                    binMin[b] = glm::vec3(std::numeric_limits<float>::max());
+                    binMax[b] = glm::vec3(-std::numeric_limits<float>::max());
+                }
+                for (uint32_t s = node.leftFirst; s < node.leftFirst + node.count; ++s) {
+                    uint32_t p = order[s];
+                    int b = std::min(static_cast<int>((centroids[p][axis] - centroidMin[axis]) * scale), BINS - 1);
+                    ++binCount[b];
+                    binMin[b] = glm::min(binMin[b], primitiveMin[p]);
+                    binMax[b] = glm::max(binMax[b], primitiveMax[p]);
+                }
+                // areas left of every plane from the front, right of it from the back
+                float leftCost[BINS - 1];
+                glm::vec3 sweepMin(std::numeric_limits<float>::max()), sweepMax(-std::numeric_limits<float>::max());
+                uint32_t sweepCount = 0;
+                for (int b = 0; b < BINS - 1; ++b) {
+                    sweepCount += binCount[b];
+                    if (binCount[b]) { sweepMin = glm::min(sweepMin, binMin[b]); sweepMax = glm::max(sweepMax, binMax[b]); }
+                    leftCost[b] = sweepCount ? sweepCount * HalfSurfaceArea(sweepMin, sweepMax) : 0.0f;
+                }
+                sweepMin = glm::vec3(std::numeric_limits<float>::max());
+                sweepMax = glm::vec3(-std::numeric_limits<float>::max());
+                sweepCount = 0;
+                for (int b = BINS - 1; b > 0; --b) {
+                    sweepCount += binCount[b];
+                    if (binCount[b]) { sweepMin = glm::min(sweepMin, binMin[b]); sweepMax = glm::max(sweepMax, binMax[b]); }
+                    float cost = leftCost[b - 1] + (sweepCount ? sweepCount * HalfSurfaceArea(sweepMin, sweepMax) : 0.0f);
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestPlane = b;
+                    }
+                }
+            }
+            // a leaf is cheaper unless it is too large to scan
+            if (bestAxis < 0 || (bestCost >= node.count * HalfSurfaceArea(boundsMin, boundsMax) && node.count <= 4 * maxLeaf)) continue;
+
+            float scale = BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+            auto middle = std::partition(order.begin() + node.leftFirst, order.begin() + node.leftFirst + node.count, [&](uint32_t p) {
+                return std::min(static_cast<int>((centroids[p][bestAxis] - centroidMin[bestAxis]) * scale), BINS - 1) < bestPlane;
+            });
+            uint32_t leftCount = static_cast<uint32_t>(middle - order.begin()) - node.leftFirst;
+            if (leftCount == 0 || leftCount == node.count) continue;
+
+            uint32_t left = static_cast<uint32_t>(nodes.size());
+            nodes.push_back({ glm::vec3(0.0f), node.leftFirst, glm::vec3(0.0f), leftCount });
+            nodes.push_back({ glm::vec3(0.0f), node.leftFirst + leftCount, glm::vec3(0.0f), node.count - leftCount });
+            nodes[index].leftFirst = left;
+            nodes[index].count = 0;
+            stack.push_back({ left + 1, depth + 1 });
+            stack.push_back({ left, depth + 1 });
+        }
+    }
+
+    // Front to back: the nearer child first, the other one stays on the stack until the ray gets
+    // there with nothing closer found. leaf(first, count, tMax) tests the primitives in the slots and
+    // lowers tMax to a hit. The stack holds at most one node per level, build() keeps the tree within
+    // STACK_SIZE levels.
+    template <class Leaf>
+    void traverse(const glm::vec3& origin, const glm::vec3& direction, float& tMax, Leaf leaf) const {
+        if (nodes.empty()) return;
+        glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        if (IntersectBounds(nodes[0].boundsMin, nodes[0].boundsMax, origin, inverseDirection, tMax) == std::numeric_limits<float>::infinity()) return;
+        uint32_t stack[STACK_SIZE];
+        float stackNear[STACK_SIZE];
+        int top = 0;
+        uint32_t index = 0;
+        while (true) {
+            const BvhNode& node = nodes[index];
+            if (node.count > 0) {
+                leaf(node.leftFirst, node.count, tMax);
+            } else {
+                uint32_t near = node.leftFirst, far = node.leftFirst + 1;
+                float tNear = IntersectBounds(nodes[near].boundsMin, nodes[near].boundsMax, origin, inverseDirection, tMax);
+                float tFar = IntersectBounds(nodes[far].boundsMin, nodes[far].boundsMax, origin, inverseDirection, tMax);
+                if (tFar < tNear) {
+                    std::swap(near, far);
+                    std::swap(tNear, tFar);
+                }
+                if (tNear != std::numeric_limits<float>::infinity()) {
+                    if (tFar != std::numeric_limits<float>::infinity()) {
+                        assert(top < STACK_SIZE);
+                        stack[top] = far;
+                        stackNear[top++] = tFar;
+                    }
+                    index = near;
+                    continue;
+                }
+            }
+            // next on the stack that is still nearer than the closest hit
+            do {
+                if (top == 0) return;
+                --top;
+            } while (stackNear[top] >= tMax);
+            index = stack[top];
+        }
+    }
+};
+
+// Moeller-Trumbore against either side of triangle p, a hit closer than tMax lowers it. u and v are
+// the barycentric weights of the second and third vertex.
+inline bool IntersectTriangle(const glm::vec3* p, const glm::vec3& origin, const glm::vec3& direction, float& tMax, float& u, float& v) {
+    glm::vec3 edge1 = p[1] - p[0], edge2 = p[2] - p[0];
+    glm::vec3 h = glm::cross(direction, edge2);
+    float determinant = glm::dot(edge1, h);
+    if (std::fabs(determinant) < 1e-12f) return false;
+    float inverse = 1.0f / determinant;
+    glm::vec3 toOrigin = origin - p[0];
+    float hitU = glm::dot(toOrigin, h) * inverse;
+    if (hitU < 0.0f || hitU > 1.0f) return false;
+    glm::vec3 q = glm::cross(toOrigin, edge1);
+    float hitV = glm::dot(direction, q) * inverse;
+    if (hitV < 0.0f || hitU + hitV > 1.0f) return false;
+    float distance = glm::dot(edge2, q) * inverse;
+    if (distance <= 1e-6f || distance >= tMax) return false;
+    tMax = distance;
+    u = hitU;
+    v = hitV;
+    return true;
+}
+
+// BVH over the drawn triangles of a mesh and its child meshes, three vertices per triangle in the
+// order of the leaves
+struct MeshBvh {
+    static constexpr uint32_t MAX_LEAF = 4;
+
+    Bvh bvh;
+    std::vector<glm::vec3> triangles;
+
+    bool empty() const { return bvh.nodes.empty(); }
+    const glm::vec3& boundsMin() const { return bvh.nodes[0].boundsMin; }
+    const glm::vec3& boundsMax() const { return bvh.nodes[0].boundsMax; }
+
+    // model and its child meshes, whose mPointCount vertices are drawn as triangles
+    void build(const ModelData& model) {
+        std::vector<glm::vec3> vertices;
+        gather(model, glm::mat4(1.0f), vertices);
+        size_t count = vertices.size() / 3;
+        std::vector<glm::vec3> primitiveMin(count), primitiveMax(count);
+        for (size_t t = 0; t < count; ++t) {
+            const glm::vec3* v = &vertices[3 * t];
+            primitiveMin[t] = glm::min(glm::min(v[0], v[1]), v[2]);
+            primitiveMax[t] = glm::max(glm::max(v[0], v[1]), v[2]);
+        }
+        bvh.build(primitiveMin, primitiveMax, MAX_LEAF);
+        triangles.resize(3 * count);
+        for (size_t s = 0; s < count; ++s)
+            for (int c = 0; c < 3; ++c) triangles[3 * s + c] = vertices[3 * size_t(bvh.order[s]) + c];
+    }
+
+    // the vertices of mesh and its children in model space, each placed by the local transforms down to it
+    static void gather(const ModelData& mesh, const glm::mat4& parent, std::vector<glm::vec3>& vertices) {
+        glm::mat4 toModel = parent * mesh.mLocalTransform;
+        size_t count = std::min(mesh.mPointCount, mesh.mVertices.size()) / 3 * 3;
+        for (size_t i = 0; i < count; ++i)
+            vertices.push_back(glm::vec3(toModel * glm::vec4(mesh.mVertices[i], 1.0f)));
+        for (const ModelData& child : mesh.mChildMeshes)
+            gather(child, toModel, vertices);
+    }
+
+    // nearest triangle closer than tMax, which becomes its distance
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, float& tMax, uint32_t& triangle, float& u, float& v) const {
+        bool hit = false;
+        bvh.traverse(origin, direction, tMax, [&](uint32_t first, uint32_t count, float& t) {
+            for (uint32_t s = first; s < first + count; ++s) {
+                if (IntersectTriangle(&triangles[3 * size_t(s)], origin, direction, t, u, v)) {
+                    triangle = bvh.order[s];
+                    hit = true;
+                }
+            }
+        });
+        return hit;
+    }
+};
+
+struct PickHit {
+    float distance = std::numeric_limits<float>::infinity();   // along the ray direction, in its units
+    Entity entity = NO_ENTITY;          // the static models are not entities
+    int staticModel = -1;               // index in staticModels
+    uint32_t triangle = 0;              // in the drawn triangles of the mesh, then of its child meshes in order
+    float u = 0.0f, v = 0.0f;           // barycentric weights of the second and third vertex
+
+    bool hit() const { return distance != std::numeric_limits<float>::infinity(); }
+};
+
+// Nearest triangle under a ray over the static models and the entities of the meshes ActorWorld
+// draws. Every mesh gets its BVH once at load; a top level BVH over the instances, each a mesh BVH
+// and its model matrix, is rebuilt from the current transforms for every pick, and the ray goes into
+// the space of an instance to traverse its mesh BVH. The fish drawn by their own renderers and the
+// lava, whose heights change every frame, are not picked.
+class ScenePicker {
+
+private:
+    ScenePicker() {}
+
+    ScenePicker(const ScenePicker&) = delete;
+    ScenePicker& operator=(const ScenePicker&) = delete;
+public:
+
+    static ScenePicker* Instance()
+    {
+        static ScenePicker* instance = new ScenePicker();
+        return instance;
+    }
+
+    struct PickInstance {
+        const MeshBvh* mesh;
+        glm::mat4 toObject;             // inverse model matrix
+        Entity entity;
+        int staticModel;
+    };
+
+    std::vector<MeshBvh> staticBvhs;    // by index in staticModels
+    std::vector<MeshBvh> meshBvhs;      // by MeshHandle, empty for the meshes ActorWorld does not draw
+    std::vector<PickInstance> instances;
+    Bvh topLevel;
+
+    void Init(const std::vector<ModelData>& statics, const ActorWorld& world) {
+        size_t triangles = 0;
+        staticBvhs.resize(statics.size());
+        for (size_t i = 0; i < statics.size(); ++i) {
+            staticBvhs[i].build(statics[i]);
+            triangles += staticBvhs[i].triangles.size() / 3;
+        }
+        meshBvhs.resize(world.meshes.size());
+        for (size_t m = 0; m < world.meshes.size(); ++m) {
+            if (!world.meshes[m].batched) continue;
+            meshBvhs[m].build(world.meshes[m].model);
+            triangles += meshBvhs[m].triangles.size() / 3;
+        }
+        std::cout << "Picking BVHs: " << triangles << " triangles in " << statics.size() + world.meshes.size() << " meshes" << std::endl;
+    }
+
+    // one instance per static model and per entity of a mesh with a BVH, and the top level over them
+    void buildTopLevel(ActorWorld& world) {
+        instances.clear();
+        for (size_t i = 0; i < staticBvhs.size(); ++i)
+            if (!staticBvhs[i].empty()) instances.push_back({ &staticBvhs[i], glm::mat4(1.0f), NO_ENTITY, static_cast<int>(i) });
+        std::vector<glm::vec3> instanceMin, instanceMax;
+        std::vector<glm::mat4> toWorld(instances.size(), glm::mat4(1.0f));
+        world.each(COMPONENT_RENDER_MESH, [&](Archetype& a) {
+            for (size_t i = 0; i < a.size(); ++i) {
+                MeshHandle mesh = a.meshes[i].mesh;
+                if (mesh >= meshBvhs.size() || meshBvhs[mesh].empty()) continue;
+                // the free element may hold an animation phase, see FishRenderer::setPhase
+                glm::mat4 model = a.matrices[i];
+                model[0][3] = 0.0f;
+                instances.push_back({ &meshBvhs[mesh], glm::inverse(model), a.entities[i], -1 });
+                toWorld.push_back(model);
+            }
+        });
+        for (size_t i = 0; i < instances.size(); ++i) {
+            glm::vec3 boundsMin(std::numeric_limits<float>::max()), boundsMax(-std::numeric_limits<float>::max());
+            for (int corner = 0; corner < 8; ++corner) {
+                glm::vec3 local((corner & 1 ? instances[i].mesh->boundsMax() : instances[i].mesh->boundsMin()).x,
+                                (corner & 2 ? instances[i].mesh->boundsMax() : instances[i].mesh->boundsMin()).y,
+                                (corner & 4 ? instances[i].mesh->boundsMax() : instances[i].mesh->boundsMin()).z);
+                glm::vec3 corner3 = glm::vec3(toWorld[i] * glm::vec4(local, 1.0f));
+                boundsMin = glm::min(boundsMin, corner3);
+                boundsMax = glm::max(boundsMax, corner3);
+            }
+            instanceMin.push_back(boundsMin);
+            instanceMax.push_back(boundsMax);
+        }
+        topLevel.build(instanceMin, instanceMax, 1);
+    }
+
+    // nearest hit along the ray from origin, direction need not be unit length
+    PickHit intersect(const glm::vec3& origin, const glm::vec3& direction) const {
+        PickHit hit;
+        float tMax = std::numeric_limits<float>::infinity();
+        topLevel.traverse(origin, direction, tMax, [&](uint32_t first, uint32_t count, float& t) {
+            for (uint32_t s = first; s < first + count; ++s) {
+                const PickInstance& instance = instances[topLevel.order[s]];
+                // the distance stays in world units as the direction is transformed without normalizing it
+                glm::vec3 localOrigin = glm::vec3(instance.toObject * glm::vec4(origin, 1.0f));
+                glm::vec3 localDirection = glm::vec3(instance.toObject * glm::vec4(direction, 0.0f));
+                if (instance.mesh->intersect(localOrigin, localDirection, t, hit.triangle, hit.u, hit.v)) {
+                    hit.distance = t;
+                    hit.entity = instance.entity;
+                    hit.staticModel = instance.staticModel;
+                }
+            }
+        });
+        return hit;
+    }
+
+    PickHit pick(const glm::vec3& origin, const glm::vec3& direction) {
+        buildTopLevel(*ActorWorld::Instance());
+        return intersect(origin, direction);
+    }
+};
+
+// Build and query times for a one million triangle terrain and a thousand instances of a 3k
+// triangle rock, with the nearest hit of some rays checked against testing every triangle.
+void benchmarkPicking() {
+    auto gridMesh = [](int cells, float size, float height, float frequency) {
+        ModelData model;
+        auto at = [&](int x, int z) {
+            float fx = size * x / cells, fz = size * z / cells;
+            return glm::vec3(fx - 0.5f * size, height * std::sin(frequency * fx) * std::cos(frequency * fz), fz - 0.5f * size);
+        };
+        for (int z = 0; z < cells; ++z)
+            for (int x = 0; x < cells; ++x)
+                for (glm::ivec2 corner : { glm::ivec2(0, 0), glm::ivec2(1, 0), glm::ivec2(1, 1), glm::ivec2(0, 0), glm::ivec2(1, 1), glm::ivec2(0, 1) })
+                    model.mVertices.push_back(at(x + corner.x, z + corner.y));
+        model.mPointCount = model.mVertices.size();
+        return model;
+    };
+    std::vector<ModelData> statics = { gridMesh(708, 4000.0f, 30.0f, 0.01f) };
+    ModelData rock = gridMesh(40, 6.0f, 2.0f, 1.0f);
+
+    ScenePicker* picker = ScenePicker::Instance();
+    ActorWorld* world = ActorWorld::Instance();
+    MeshHandle rockMesh = world->addMesh(rock);
+    std::cout << "Picking" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    picker->Init(statics, *world);
+    std::cout << "  mesh BVHs: " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<Entity> rocks;
+    for (int i = 0; i < 1000; ++i) {
+        Entity entity = world->create(COMPONENT_TRANSFORM | COMPONENT_RENDER_MESH);
+        Archetype& a = world->archetypeOf(entity);
+        size_t row = world->rowOf(entity);
+        a.transforms[row].position = glm::vec3(1500.0f * unit(random), 40.0f, 1500.0f * unit(random));
+        a.transforms[row].rotation = glm::vec3(0.0f, glm::pi<float>() * unit(random), 0.0f);
+        a.meshes[row].mesh = rockMesh;
+        rocks.push_back(entity);
+    }
+    world->updateMatrices();
+    benchmark::Measure("top level BVH, 1001 instances", 20, [&]() { picker->buildTopLevel(*world); });
+
+    const int RAYS = 1000;
+    std::vector<glm::vec3> origins(RAYS), directions(RAYS);
+    for (int r = 0; r < RAYS; ++r) {
+        origins[r] = glm::vec3(1500.0f * unit(random), 200.0f, 1500.0f * unit(random));
+        directions[r] = glm::normalize(glm::vec3(0.3f * unit(random), -1.0f, 0.3f * unit(random)));
+    }
+    size_t hits = 0;
+    benchmark::Measure(std::to_string(RAYS) + " rays, nearest hit", 20, [&]() {
+        hits = 0;
+        for (int r = 0; r < RAYS; ++r) hits += picker->intersect(origins[r], directions[r]).hit();
+    });
+    std::cout << "  " << hits << " of " << RAYS << " rays hit" << std::endl;
+
+    // every triangle of the terrain and every rock for a few rays
+    int mismatches = 0;
+    for (int r = 0; r < 5; ++r) {
+        float nearest = std::numeric_limits<float>::infinity(), u, v;
+        for (const ScenePicker::PickInstance& instance : picker->instances) {
+            glm::vec3 localOrigin = glm::vec3(instance.toObject * glm::vec4(origins[r], 1.0f));
+            glm::vec3 localDirection = glm::vec3(instance.toObject * glm::vec4(directions[r], 0.0f));
+            for (size_t t = 0; t < instance.mesh->triangles.size(); t += 3)
+                IntersectTriangle(&instance.mesh->triangles[t], localOrigin, localDirection, nearest, u, v);
+        }
+        PickHit hit = picker->intersect(origins[r], directions[r]);
+        if (hit.hit() != (nearest != std::numeric_limits<float>::infinity()) || (hit.hit() && std::fabs(hit.distance - nearest) > 1e-3f * nearest)) ++mismatches;
+    }
+    std::cout << "  " << mismatches << " of 5 rays differ from testing every triangle" << std::endl;
+
+    // a child mesh placed by its local transform blocks a ray that passes over the root mesh
+    ModelData tower = rock;
+    tower.mChildMeshes.push_back(rock);
+    tower.mChildMeshes.back().mLocalTransform = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 10.0f, 0.0f));
+    MeshBvh towerBvh;
+    towerBvh.build(tower);
+    float tChild = std::numeric_limits<float>::infinity(), u, v;
+    uint32_t triangle = 0;
+    bool childHit = towerBvh.intersect(glm::vec3(0.5f, 20.0f, 0.5f), glm::vec3(0.0f, -1.0f, 0.0f), tChild, triangle, u, v)
+        && tChild < 15.0f && triangle >= rock.mPointCount / 3;
+    std::cout << "  ray onto a child mesh 10 units above its root: " << (childHit ? "hits the child" : "MISSES the child") << std::endl;
+
+    for (Entity entity : rocks) world->destroy(entity);
+    world->meshes.pop_back();
+    picker->staticBvhs.clear();
+    picker->meshBvhs.clear();
+    picker->instances.clear();
+    picker->topLevel = Bvh();
+}
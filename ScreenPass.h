@@ -0,0 +1,45 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm.hpp>
+
+#include "ProgramSetting.h"
+
+// Shared pieces for full screen passes: a fullscreen triangle and a copy of the scene depth
+namespace screenPass
+{
+	GLuint emptyVAO = 0;            // the fullscreen triangle is generated from gl_VertexID
+	GLuint sceneDepthTexture = 0;   // copy of the default framebuffer depth, width x height
+
+	void Init()
+	{
+		if (emptyVAO != 0)
+			return;
+		glGenVertexArrays(1, &emptyVAO);
+
+		glGenTextures(1, &sceneDepthTexture);
+		glBindTexture(GL_TEXTURE_2D, sceneDepthTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// copy the depth of the opaque scene drawn so far, call after the opaque pass
+	GLuint CopySceneDepth()
+	{
+		glBindTexture(GL_TEXTURE_2D, sceneDepthTexture);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return sceneDepthTexture;
+	}
+
+	// draw a triangle covering the viewport, use with screenVertexShader.txt
+	void Draw()
+	{
+		glBindVertexArray(emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+	}
+}
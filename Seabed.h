@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+#include <glm.hpp>
+
+#include "ModelStructure.h"
+#include "Heightmap.h"
+
+// The ground of the whole scene: the static models baked once at load into a heightmap with its
+// slopes, over their xz bounds. Crabs walk on it, the fish school and the camera stay above it, and
+// every query is a bilinear lookup of four grid points.
+class Seabed {
+
+private:
+    Seabed() {}
+
+    Seabed(const Seabed&) = delete;
+    Seabed& operator=(const Seabed&) = delete;
+public:
+
+    static Seabed* Instance()
+    {
+        static Seabed* instance = new Seabed();
+        return instance;
+    }
+
+    const int RESOLUTION = 512;                 // grid points along the longer side
+    const float MARGIN = 10.0f;                 // beyond the models, heights clamp to the border anyway
+
+    Heightmap map;
+
+    void Init(const std::vector<ModelData>& models) {
+        glm::vec3 boundsMin(std::numeric_limits<float>::max()), boundsMax(-std::numeric_limits<float>::max());
+        for (const ModelData& model : models)
+            GrowBounds(model, boundsMin, boundsMax);
+        if (boundsMin.x > boundsMax.x) {
+            boundsMin = glm::vec3(0.0f);
+            boundsMax = glm::vec3(0.0f);
+        }
+        glm::vec2 size(boundsMax.x - boundsMin.x + 2.0f * MARGIN, boundsMax.z - boundsMin.z + 2.0f * MARGIN);
+        float cellSize = std::max(size.x, size.y) / (RESOLUTION - 1);
+        map.Resize(glm::vec2(boundsMin.x, boundsMin.z) - MARGIN, cellSize,
+            std::max(int(std::ceil(size.x / cellSize)) + 1, 2), std::max(int(std::ceil(size.y / cellSize)) + 1, 2), boundsMin.y);
+        map.Bake(models, boundsMin.y);
+        std::cout << "Seabed: " << map.resolutionX << " x " << map.resolutionZ << " heights, " << cellSize << " units apart" << std::endl;
+    }
+
+    bool ready() const { return !map.heights.empty(); }
+
+    // lowest height before Init, so that nothing is pushed up
+    float height(float x, float z) const {
+        return ready() ? map.Sample(x, z) : -std::numeric_limits<float>::max();
+    }
+
+    // height change per unit along x and z, flat before Init
+    glm::vec2 slope(float x, float z) const {
+        return ready() ? map.SampleSlope(x, z) : glm::vec2(0.0f);
+    }
+
+    glm::vec3 normal(float x, float z) const {
+        return ready() ? map.SampleNormal(x, z) : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+
+    // position raised to at least clearance above the seabed
+    glm::vec3 above(const glm::vec3& position, float clearance) const {
+        return glm::vec3(position.x, std::max(position.y, height(position.x, position.z) + clearance), position.z);
+    }
+
+private:
+    static void GrowBounds(const ModelData& model, glm::vec3& boundsMin, glm::vec3& boundsMax) {
+        for (const glm::vec3& vertex : model.mVertices) {
+            boundsMin = glm::min(boundsMin, vertex);
+            boundsMax = glm::max(boundsMax, vertex);
+        }
+        for (const ModelData& child : model.mChildMeshes)
+            GrowBounds(child, boundsMin, boundsMax);
+    }
+};
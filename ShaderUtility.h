@@ -114,4 +114,33 @@ GLuint compileShader(const char* source, GLenum type) {
 		exit(1);
 	}
 	return shader;
-}
\ No newline at end of file
+}
+
+// Compile and link a vertex + fragment shader pair read from files
+GLuint createShaderProgram(const char* vertexFile, const char* fragmentFile) {
+	const char* vertexSource = readShaderSource(vertexFile);
+	const char* fragmentSource = readShaderSource(fragmentFile);
+
+	GLuint vertexShader = compileShader(vertexSource, GL_VERTEX_SHADER);
+	GLuint fragmentShader = compileShader(fragmentSource, GL_FRAGMENT_SHADER);
+	delete[] vertexSource;
+	delete[] fragmentSource;
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+	glLinkProgram(program);
+
+	GLint success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success) {
+		char infoLog[512];
+		glGetProgramInfoLog(program, 512, nullptr, infoLog);
+		std::cerr << "Shader Linking Error (" << vertexFile << ", " << fragmentFile << "): " << infoLog << std::endl;
+		exit(1);
+	}
+
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	return program;
+}
@@ -0,0 +1,470 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <iostream>
+#include <glm.hpp>
+#include <assimp/scene.h>
+
+#include "LavaHeightField.h"
+#include "ThreadPool.h"
+#include "Benchmark.h"
+
+// Affine joint matrix kept as its first three rows, which is also the layout of the bone palette
+// the skinning shader reads: three vec4 texels per joint.
+struct JointMatrix {
+    glm::vec4 rows[3];
+};
+
+inline JointMatrix IdentityJoint() {
+    return { { glm::vec4(1.0f, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 0.0f), glm::vec4(0.0f, 0.0f, 1.0f, 0.0f) } };
+}
+
+// assimp matrices are row major
+inline JointMatrix ToJointMatrix(const aiMatrix4x4& m) {
+    return { { glm::vec4(m.a1, m.a2, m.a3, m.a4), glm::vec4(m.b1, m.b2, m.b3, m.b4), glm::vec4(m.c1, m.c2, m.c3, m.c4) } };
+}
+
+// a * b
+inline JointMatrix MultiplyJoints(const JointMatrix& a, const JointMatrix& b) {
+    JointMatrix out;
+    for (int r = 0; r < 3; ++r)
+        out.rows[r] = a.rows[r].x * b.rows[0] + a.rows[r].y * b.rows[1] + a.rows[r].z * b.rows[2] + glm::vec4(0.0f, 0.0f, 0.0f, a.rows[r].w);
+    return out;
+}
+
+// Local joint transforms as translation, rotation quaternion and scale, one array per component and
+// padded to a multiple of four joints so that four rotations fill an SSE register. The padding
+// joints stay at the identity.
+struct SkeletonPose {
+    std::vector<float> tx, ty, tz;
+    std::vector<float> qx, qy, qz, qw;
+    std::vector<float> sx, sy, sz;
+
+    void resize(int joints) {
+        size_t padded = (joints + 3) & ~3;
+        for (std::vector<float>* v : { &tx, &ty, &tz, &qx, &qy, &qz })
+            v->assign(padded, 0.0f);
+        for (std::vector<float>* v : { &qw, &sx, &sy, &sz })
+            v->assign(padded, 1.0f);
+    }
+
+    int padded() const { return static_cast<int>(qx.size()); }
+
+    // translation * rotation * scale of joint j
+    JointMatrix local(int j) const {
+        float x = qx[j], y = qy[j], z = qz[j], w = qw[j];
+        JointMatrix m;
+        m.rows[0] = glm::vec4((1.0f - 2.0f * (y * y + z * z)) * sx[j], 2.0f * (x * y - w * z) * sy[j], 2.0f * (x * z + w * y) * sz[j], tx[j]);
+        m.rows[1] = glm::vec4(2.0f * (x * y + w * z) * sx[j], (1.0f - 2.0f * (x * x + z * z)) * sy[j], 2.0f * (y * z - w * x) * sz[j], ty[j]);
+        m.rows[2] = glm::vec4(2.0f * (x * z - w * y) * sx[j], 2.0f * (y * z + w * x) * sy[j], (1.0f - 2.0f * (x * x + y * y)) * sz[j], tz[j]);
+        return m;
+    }
+};
+
+struct Skeleton {
+    std::vector<std::string> names;
+    std::vector<int> parents;               // -1 for the root, a parent always comes before its children
+    std::vector<JointMatrix> inverseBind;   // mesh space to joint space, identity for nodes that are not bones
+    SkeletonPose bindPose;                  // node transforms, kept by the joints a clip does not move
+
+    int jointCount() const { return static_cast<int>(parents.size()); }
+
+    int find(const std::string& name) const {
+        auto it = std::find(names.begin(), names.end(), name);
+        return it == names.end() ? -1 : static_cast<int>(it - names.begin());
+    }
+};
+
+// Keys of one joint, each channel sorted by time in seconds
+struct AnimationTrack {
+    std::vector<float> positionTimes, positionX, positionY, positionZ;
+    std::vector<float> rotationTimes, rotationX, rotationY, rotationZ, rotationW;
+    std::vector<float> scaleTimes, scaleX, scaleY, scaleZ;
+};
+
+struct AnimationClip {
+    std::string name;
+    float duration = 1.0f;                  // seconds
+    std::vector<AnimationTrack> tracks;     // one per joint, empty for the joints the clip does not move
+};
+
+// Every node of the scene becomes a joint, depth first so that parents come first. Nodes without a
+// bone still place the bones below them.
+inline void ImportSkeleton(const aiScene* scene, Skeleton& skeleton) {
+    skeleton = Skeleton();
+    std::vector<const aiNode*> nodes;
+    std::vector<std::pair<const aiNode*, int>> stack = { { scene->mRootNode, -1 } };
+    while (!stack.empty()) {
+        auto [node, parent] = stack.back();
+        stack.pop_back();
+        int joint = static_cast<int>(nodes.size());
+        nodes.push_back(node);
+        skeleton.names.push_back(node->mName.C_Str());
+        skeleton.parents.push_back(parent);
+        for (unsigned int c = node->mNumChildren; c-- > 0;)
+            stack.push_back({ node->mChildren[c], joint });
+    }
+
+    skeleton.inverseBind.assign(nodes.size(), IdentityJoint());
+    skeleton.bindPose.resize(skeleton.jointCount());
+    SkeletonPose& pose = skeleton.bindPose;
+    for (int j = 0; j < skeleton.jointCount(); ++j) {
+        aiVector3D scale, position;
+        aiQuaternion rotation;
+        nodes[j]->mTransformation.Decompose(scale, rotation, position);
+        pose.tx[j] = position.x; pose.ty[j] = position.y; pose.tz[j] = position.z;
+        pose.qx[j] = rotation.x; pose.qy[j] = rotation.y; pose.qz[j] = rotation.z; pose.qw[j] = rotation.w;
+        pose.sx[j] = scale.x; pose.sy[j] = scale.y; pose.sz[j] = scale.z;
+    }
+}
+
+// the animations of the scene as clips of skeleton, key times converted from ticks to seconds
+inline void ImportClips(const aiScene* scene, const Skeleton& skeleton, std::vector<AnimationClip>& clips) {
+    for (unsigned int a = 0; a < scene->mNumAnimations; ++a) {
+        const aiAnimation* animation = scene->mAnimations[a];
+        float ticksPerSecond = animation->mTicksPerSecond != 0.0 ? float(animation->mTicksPerSecond) : 25.0f;
+        AnimationClip clip;
+        clip.name = animation->mName.C_Str();
+        clip.duration = std::max(float(animation->mDuration) / ticksPerSecond, 1e-3f);
+        clip.tracks.resize(skeleton.jointCount());
+
+        for (unsigned int c = 0; c < animation->mNumChannels; ++c) {
+            const aiNodeAnim* channel = animation->mChannels[c];
+            int joint = skeleton.find(channel->mNodeName.C_Str());
+            if (joint < 0) continue;
+            AnimationTrack& track = clip.tracks[joint];
+
+            // keys compare by time
+            std::vector<aiVectorKey> positions(channel->mPositionKeys, channel->mPositionKeys + channel->mNumPositionKeys);
+            std::vector<aiQuatKey> rotations(channel->mRotationKeys, channel->mRotationKeys + channel->mNumRotationKeys);
+            std::vector<aiVectorKey> scales(channel->mScalingKeys, channel->mScalingKeys + channel->mNumScalingKeys);
+            std::stable_sort(positions.begin(), positions.end());
+            std::stable_sort(rotations.begin(), rotations.end());
+            std::stable_sort(scales.begin(), scales.end());
+            for (const aiVectorKey& key : positions) {
+                track.positionTimes.push_back(float(key.mTime) / ticksPerSecond);
+                track.positionX.push_back(key.mValue.x);
+                track.positionY.push_back(key.mValue.y);
+                track.positionZ.push_back(key.mValue.z);
+            }
+            for (const aiQuatKey& key : rotations) {
+                track.rotationTimes.push_back(float(key.mTime) / ticksPerSecond);
+                track.rotationX.push_back(key.mValue.x);
+                track.rotationY.push_back(key.mValue.y);
+                track.rotationZ.push_back(key.mValue.z);
+                track.rotationW.push_back(key.mValue.w);
+            }
+            for (const aiVectorKey& key : scales) {
+                track.scaleTimes.push_back(float(key.mTime) / ticksPerSecond);
+                track.scaleX.push_back(key.mValue.x);
+                track.scaleY.push_back(key.mValue.y);
+                track.scaleZ.push_back(key.mValue.z);
+            }
+        }
+        clips.push_back(clip);
+    }
+}
+
+// Append the joints and weights of the vertices of mesh, the four largest weights renormalised, and
+// store the inverse bind matrices of its bones. A vertex without weights follows the root.
+inline void ImportSkinWeights(const aiMesh* mesh, Skeleton& skeleton, std::vector<glm::ivec4>& boneIds, std::vector<glm::vec4>& boneWeights) {
+    size_t first = boneIds.size();
+    boneIds.resize(first + mesh->mNumVertices, glm::ivec4(0));
+    boneWeights.resize(first + mesh->mNumVertices, glm::vec4(0.0f));
+    for (unsigned int b = 0; b < mesh->mNumBones; ++b) {
+        const aiBone* bone = mesh->mBones[b];
+        int joint = skeleton.find(bone->mName.C_Str());
+        if (joint < 0) continue;
+        skeleton.inverseBind[joint] = ToJointMatrix(bone->mOffsetMatrix);
+        for (unsigned int w = 0; w < bone->mNumWeights; ++w) {
+            size_t v = first + bone->mWeights[w].mVertexId;
+            // replace the smallest of the four slots
+            int smallest = 0;
+            for (int k = 1; k < 4; ++k)
+                if (boneWeights[v][k] < boneWeights[v][smallest]) smallest = k;
+            if (bone->mWeights[w].mWeight > boneWeights[v][smallest]) {
+                boneWeights[v][smallest] = bone->mWeights[w].mWeight;
+                boneIds[v][smallest] = joint;
+            }
+        }
+    }
+    for (size_t v = first; v < boneWeights.size(); ++v) {
+        float sum = boneWeights[v].x + boneWeights[v].y + boneWeights[v].z + boneWeights[v].w;
+        boneWeights[v] = sum > 0.0f ? boneWeights[v] / sum : glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+    }
+}
+
+// Slerp approximated by a normalised lerp with a corrected weight (Zeux, "Approximating slerp"),
+// within 2e-3 radians of the exact slerp and without acos and sin. Takes the shorter arc.
+inline void ApproximateSlerp(const float a[4], const float b[4], float t, float out[4]) {
+    float d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    float absD = std::fabs(d);
+    float A = 1.0904f + absD * (-3.2452f + absD * (3.55645f - absD * 1.43519f));
+    float B = 0.848013f + absD * (-1.06021f + absD * 0.215638f);
+    float k = A * (t - 0.5f) * (t - 0.5f) + B;
+    float ot = t + t * (t - 0.5f) * (t - 1.0f) * k;
+    float lt = 1.0f - ot;
+    float rt = d < 0.0f ? -ot : ot;
+    float length = 0.0f;
+    for (int i = 0; i < 4; ++i) {
+        out[i] = a[i] * lt + b[i] * rt;
+        length += out[i] * out[i];
+    }
+    float inverse = 1.0f / std::sqrt(length);
+    for (int i = 0; i < 4; ++i) out[i] *= inverse;
+}
+
+// rotations of out = slerp(a, b, weights[j]) for every joint, four joints at a time with SSE; out may be a or b
+inline void SlerpRotations(const SkeletonPose& a, const SkeletonPose& b, const float* weights, SkeletonPose& out) {
+    int j = 0;
+    const int count = a.padded();
+#ifdef LAVA_SSE
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    for (; j + 4 <= count; j += 4) {
+        __m128 ax = _mm_loadu_ps(&a.qx[j]), ay = _mm_loadu_ps(&a.qy[j]), az = _mm_loadu_ps(&a.qz[j]), aw = _mm_loadu_ps(&a.qw[j]);
+        __m128 bx = _mm_loadu_ps(&b.qx[j]), by = _mm_loadu_ps(&b.qy[j]), bz = _mm_loadu_ps(&b.qz[j]), bw = _mm_loadu_ps(&b.qw[j]);
+        __m128 t = _mm_loadu_ps(weights + j);
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+        __m128 absD = _mm_andnot_ps(signMask, d);
+        __m128 A = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(absD, _mm_add_ps(_mm_set1_ps(-3.2452f),
+            _mm_mul_ps(absD, _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(absD, _mm_set1_ps(1.43519f)))))));
+        __m128 B = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(absD, _mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(absD, _mm_set1_ps(0.215638f)))));
+        __m128 centred = _mm_sub_ps(t, half);
+        __m128 k = _mm_add_ps(_mm_mul_ps(A, _mm_mul_ps(centred, centred)), B);
+        __m128 ot = _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(t, centred), _mm_mul_ps(_mm_sub_ps(t, one), k)));
+        __m128 lt = _mm_sub_ps(one, ot);
+        __m128 rt = _mm_xor_ps(ot, _mm_and_ps(d, signMask));
+
+        __m128 x = _mm_add_ps(_mm_mul_ps(ax, lt), _mm_mul_ps(bx, rt));
+        __m128 y = _mm_add_ps(_mm_mul_ps(ay, lt), _mm_mul_ps(by, rt));
+        __m128 z = _mm_add_ps(_mm_mul_ps(az, lt), _mm_mul_ps(bz, rt));
+        __m128 w = _mm_add_ps(_mm_mul_ps(aw, lt), _mm_mul_ps(bw, rt));
+        __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+        __m128 inverse = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+        _mm_storeu_ps(&out.qx[j], _mm_mul_ps(x, inverse));
+        _mm_storeu_ps(&out.qy[j], _mm_mul_ps(y, inverse));
+        _mm_storeu_ps(&out.qz[j], _mm_mul_ps(z, inverse));
+        _mm_storeu_ps(&out.qw[j], _mm_mul_ps(w, inverse));
+    }
+#endif
+    for (; j < count; ++j) {
+        float qa[4] = { a.qx[j], a.qy[j], a.qz[j], a.qw[j] };
+        float qb[4] = { b.qx[j], b.qy[j], b.qz[j], b.qw[j] };
+        float q[4];
+        ApproximateSlerp(qa, qb, weights[j], q);
+        out.qx[j] = q[0]; out.qy[j] = q[1]; out.qz[j] = q[2]; out.qw[j] = q[3];
+    }
+}
+
+// index k of the key with times[k] <= time < times[k + 1] and the weight of key k + 1
+inline int FindKey(const std::vector<float>& times, float time, float& weight) {
+    weight = 0.0f;
+    if (times.size() < 2) return 0;
+    int k = static_cast<int>(std::upper_bound(times.begin() + 1, times.end() - 1, time) - times.begin()) - 1;
+    float span = times[k + 1] - times[k];
+    weight = span > 0.0f ? std::min(std::max((time - times[k]) / span, 0.0f), 1.0f) : 0.0f;
+    return k;
+}
+
+// Per thread scratch for sampling, blending and skinning one instance
+struct PoseScratch {
+    SkeletonPose pose, next, blend;
+    std::vector<float> weights;
+    std::vector<JointMatrix> global;
+
+    void resize(int joints) {
+        pose.resize(joints);
+        next.resize(joints);
+        blend.resize(joints);
+        weights.assign(pose.padded(), 0.0f);
+        global.resize(joints);
+    }
+};
+
+// Pose of clip at time seconds, looping. Translations and scales are interpolated joint by joint,
+// the two rotation keys around the time of every joint are gathered first and then interpolated
+// together by SlerpRotations.
+inline void SampleClip(const Skeleton& skeleton, const AnimationClip& clip, float time, PoseScratch& scratch, SkeletonPose& pose) {
+    time = std::fmod(time, clip.duration);
+    if (time < 0.0f) time += clip.duration;
+    pose = skeleton.bindPose;
+    scratch.next = skeleton.bindPose;
+    std::fill(scratch.weights.begin(), scratch.weights.end(), 0.0f);
+
+    float weight;
+    for (int j = 0; j < skeleton.jointCount(); ++j) {
+        const AnimationTrack& track = clip.tracks[j];
+        if (!track.positionTimes.empty()) {
+            int k = FindKey(track.positionTimes, time, weight);
+            int n = std::min(k + 1, int(track.positionTimes.size()) - 1);
+            pose.tx[j] = track.positionX[k] + (track.positionX[n] - track.positionX[k]) * weight;
+            pose.ty[j] = track.positionY[k] + (track.positionY[n] - track.positionY[k]) * weight;
+            pose.tz[j] = track.positionZ[k] + (track.positionZ[n] - track.positionZ[k]) * weight;
+        }
+        if (!track.rotationTimes.empty()) {
+            int k = FindKey(track.rotationTimes, time, weight);
+            int n = std::min(k + 1, int(track.rotationTimes.size()) - 1);
+            pose.qx[j] = track.rotationX[k]; pose.qy[j] = track.rotationY[k]; pose.qz[j] = track.rotationZ[k]; pose.qw[j] = track.rotationW[k];
+            scratch.next.qx[j] = track.rotationX[n]; scratch.next.qy[j] = track.rotationY[n];
+            scratch.next.qz[j] = track.rotationZ[n]; scratch.next.qw[j] = track.rotationW[n];
+            scratch.weights[j] = weight;
+        }
+        if (!track.scaleTimes.empty()) {
+            int k = FindKey(track.scaleTimes, time, weight);
+            int n = std::min(k + 1, int(track.scaleTimes.size()) - 1);
+            pose.sx[j] = track.scaleX[k] + (track.scaleX[n] - track.scaleX[k]) * weight;
+            pose.sy[j] = track.scaleY[k] + (track.scaleY[n] - track.scaleY[k]) * weight;
+            pose.sz[j] = track.scaleZ[k] + (track.scaleZ[n] - track.scaleZ[k]) * weight;
+        }
+    }
+    SlerpRotations(pose, scratch.next, scratch.weights.data(), pose);
+}
+
+// a blended towards b by weight, the result in a
+inline void BlendPoses(SkeletonPose& a, const SkeletonPose& b, float weight, std::vector<float>& weights) {
+    for (int j = 0; j < a.padded(); ++j) {
+        a.tx[j] += (b.tx[j] - a.tx[j]) * weight;
+        a.ty[j] += (b.ty[j] - a.ty[j]) * weight;
+        a.tz[j] += (b.tz[j] - a.tz[j]) * weight;
+        a.sx[j] += (b.sx[j] - a.sx[j]) * weight;
+        a.sy[j] += (b.sy[j] - a.sy[j]) * weight;
+        a.sz[j] += (b.sz[j] - a.sz[j]) * weight;
+    }
+    std::fill(weights.begin(), weights.end(), weight);
+    SlerpRotations(a, b, weights.data(), a);
+}
+
+// skinning matrices of pose, joint space to mesh space times the inverse bind matrix, jointCount of them into palette
+inline void BuildPalette(const Skeleton& skeleton, const SkeletonPose& pose, std::vector<JointMatrix>& global, JointMatrix* palette) {
+    for (int j = 0; j < skeleton.jointCount(); ++j) {
+        JointMatrix local = pose.local(j);
+        int parent = skeleton.parents[j];
+        global[j] = parent < 0 ? local : MultiplyJoints(global[parent], local);
+        palette[j] = MultiplyJoints(global[j], skeleton.inverseBind[j]);
+    }
+}
+
+// Palette of one instance: both clips sampled at the same fraction of their cycle and blended by
+// weight, so that two locomotion cycles stay in step. clipB is not sampled when weight is 0. Clip is
+// an AnimationClip or a CompressedClip (CompressedClip.h), whichever SampleClip takes.
+template <class Clip>
+inline void SamplePalette(const Skeleton& skeleton, const Clip& clipA, const Clip& clipB, float cycle, float weight,
+    PoseScratch& scratch, JointMatrix* palette) {
+    SampleClip(skeleton, clipA, cycle * clipA.duration, scratch, scratch.pose);
+    if (weight > 0.0f) {
+        SampleClip(skeleton, clipB, cycle * clipB.duration, scratch, scratch.blend);
+        BlendPoses(scratch.pose, scratch.blend, weight, scratch.weights);
+    }
+    BuildPalette(skeleton, scratch.pose, scratch.global, palette);
+}
+
+// A binary tree of joints one unit apart, with two looping clips of keys keys per channel swinging
+// every joint around its own axis and bobbing the root. Every eighth joint holds still.
+inline void MakeBenchmarkRig(int joints, int keys, Skeleton& skeleton, std::vector<AnimationClip>& clips) {
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    skeleton = Skeleton();
+    skeleton.bindPose.resize(joints);
+    for (int j = 0; j < joints; ++j) {
+        skeleton.names.push_back("joint" + std::to_string(j));
+        skeleton.parents.push_back(j == 0 ? -1 : (j - 1) / 2);
+        skeleton.inverseBind.push_back(IdentityJoint());
+        skeleton.bindPose.ty[j] = j == 0 ? 0.0f : 1.0f;
+    }
+    clips.assign(2, AnimationClip());
+    for (int c = 0; c < 2; ++c) {
+        clips[c].name = "clip" + std::to_string(c);
+        clips[c].duration = 1.0f + 0.5f * c;
+        clips[c].tracks.resize(joints);
+        for (int j = 0; j < joints; ++j) {
+            AnimationTrack& track = clips[c].tracks[j];
+            glm::vec3 axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 1e-3f, 0.0f));
+            for (int k = 0; k < keys; ++k) {
+                float time = clips[c].duration * k / (keys - 1);
+                float angle = j % 8 == 7 ? 0.3f : 0.6f * std::sin(glm::two_pi<float>() * k / (keys - 1) + j);
+                track.rotationTimes.push_back(time);
+                track.rotationX.push_back(axis.x * std::sin(0.5f * angle));
+                track.rotationY.push_back(axis.y * std::sin(0.5f * angle));
+                track.rotationZ.push_back(axis.z * std::sin(0.5f * angle));
+                track.rotationW.push_back(std::cos(0.5f * angle));
+                if (j == 0) {
+                    track.positionTimes.push_back(time);
+                    track.positionX.push_back(0.0f);
+                    track.positionY.push_back(0.25f * std::sin(2.0f * glm::two_pi<float>() * k / (keys - 1)));
+                    track.positionZ.push_back(0.0f);
+                }
+            }
+        }
+    }
+}
+
+// Sampling, blending and skinning matrices for 1k and 5k characters of 40 joints on the thread pool,
+// and the SSE slerp against the exact one.
+void benchmarkSkinning() {
+    const int JOINTS = 40, KEYS = 30;
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    Skeleton skeleton;
+    std::vector<AnimationClip> clips;
+    MakeBenchmarkRig(JOINTS, KEYS, skeleton, clips);
+
+    ThreadPool* pool = ThreadPool::Instance();
+    std::vector<PoseScratch> scratch(pool->ThreadCount());
+    for (PoseScratch& s : scratch) s.resize(JOINTS);
+    std::cout << "Skinning, " << JOINTS << " joints, " << pool->ThreadCount() << " threads" << std::endl;
+    for (int count : { 1000, 5000 }) {
+        std::vector<JointMatrix> palettes(size_t(count) * JOINTS);
+        float time = 0.0f;
+        std::cout << " " << count << " characters, " << palettes.size() * sizeof(JointMatrix) / 1024 << " KB of bone palettes per frame" << std::endl;
+        benchmark::Measure("sample, blend and build palettes", 20, [&]() {
+            time += 1.0f / 60.0f;
+            pool->parallelFor(count, [&](int begin, int end, int chunk) {
+                for (int i = begin; i < end; ++i) {
+                    float cycle = time + 0.618034f * i;
+                    cycle -= std::floor(cycle);
+                    SamplePalette(skeleton, clips[0], clips[1], cycle, 0.5f + 0.5f * std::sin(time + i), scratch[chunk], &palettes[size_t(i) * JOINTS]);
+                }
+            });
+        });
+    }
+
+    // the interpolation alone, exact slerp against the corrected nlerp
+    const int ROTATIONS = 40000;
+    SkeletonPose a, b, approximate, exact;
+    for (SkeletonPose* pose : { &a, &b, &approximate, &exact }) pose->resize(ROTATIONS);
+    std::vector<float> weights(a.padded());
+    for (int j = 0; j < ROTATIONS; ++j) {
+        for (SkeletonPose* pose : { &a, &b }) {
+            glm::vec4 q(unit(random), unit(random), unit(random), unit(random));
+            q /= std::sqrt(glm::dot(q, q));
+            pose->qx[j] = q.x; pose->qy[j] = q.y; pose->qz[j] = q.z; pose->qw[j] = q.w;
+        }
+        weights[j] = 0.5f + 0.5f * unit(random);
+    }
+    benchmark::Measure(std::to_string(ROTATIONS) + " slerps, exact", 20, [&]() {
+        for (int j = 0; j < ROTATIONS; ++j) {
+            float d = a.qx[j] * b.qx[j] + a.qy[j] * b.qy[j] + a.qz[j] * b.qz[j] + a.qw[j] * b.qw[j];
+            float sign = d < 0.0f ? -1.0f : 1.0f;
+            float angle = std::acos(std::min(std::fabs(d), 1.0f));
+            float s = std::sin(angle);
+            float wa = s > 1e-6f ? std::sin((1.0f - weights[j]) * angle) / s : 1.0f - weights[j];
+            float wb = (s > 1e-6f ? std::sin(weights[j] * angle) / s : weights[j]) * sign;
+            exact.qx[j] = a.qx[j] * wa + b.qx[j] * wb;
+            exact.qy[j] = a.qy[j] * wa + b.qy[j] * wb;
+            exact.qz[j] = a.qz[j] * wa + b.qz[j] * wb;
+            exact.qw[j] = a.qw[j] * wa + b.qw[j] * wb;
+        }
+    });
+    benchmark::Measure(std::to_string(ROTATIONS) + " slerps, corrected nlerp SSE", 20, [&]() { SlerpRotations(a, b, weights.data(), approximate); });
+    float maxError = 0.0f;
+    for (int j = 0; j < ROTATIONS; ++j) {
+        float d = std::fabs(exact.qx[j] * approximate.qx[j] + exact.qy[j] * approximate.qy[j] + exact.qz[j] * approximate.qz[j] + exact.qw[j] * approximate.qw[j]);
+        maxError = std::max(maxError, 2.0f * std::acos(std::min(d, 1.0f)));
+    }
+    std::cout << "  max angle from the exact slerp: " << maxError << " radians" << std::endl;
+}
@@ -0,0 +1,331 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <iostream>
+#include <GL/glew.h>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "ModelStructure.h"
+#include "ShaderUtility.h"
+#include "InstanceTransform.h"
+#include "FishRenderer.h"
+#include "ActorWorld.h"
+#include "Skeleton.h"
+#include "CompressedClip.h"
+#include "VertexAnimationTexture.h"
+#include "AnimationLod.h"
+#include "ThreadPool.h"
+
+// One skinned mesh drawn instanced. The instances inside the view frustum are animated on the thread
+// pool, each writes the skinning matrices of its pose into one texture buffer, three vec4 rows per
+// joint, which animationVertexShader.txt reads by instance ID. The instance transforms are uploaded
+// as CompactTransforms like the rigid fish. The first clip is also baked into a vertex animation
+// texture, played back by the shader alone for crowds beyond what the CPU can pose.
+class SkinnedModel {
+public:
+    Skeleton skeleton;
+    std::vector<CompressedClip> clips;          // the imported clips, compressed
+    GLuint vao = 0;
+    GLuint vbos[5] = { 0, 0, 0, 0, 0 };         // position, normal, texture coordinates, bone IDs, bone weights
+    GLuint instanceVBO = 0;
+    GLuint paletteBuffer = 0, paletteTexture = 0;
+    GLuint textureId = 0;
+    size_t vertexCount = 0;
+    float boundingRadius = 0.0f;                // around the instance origin, including the animation
+    bool loaded = false;                        // false when the file has no bones or no clips
+    VertexAnimationTexture vat;                 // the first clip, without blending
+
+    std::vector<glm::mat4> visibleTransforms;   // upload staging, culled
+    std::vector<CompactTransform> packed;
+    std::vector<JointMatrix> palettes;          // jointCount per visible instance
+    std::vector<size_t> visibleIndex;           // of every visible instance in the transforms
+    std::vector<JointMatrix> heldPalettes;      // jointCount per instance, for the LOD tiers that skip frames
+    std::vector<unsigned char> held;            // whether the held palette of an instance is valid
+    std::vector<PoseScratch> scratch;           // per thread
+    size_t visibleCount = 0;
+
+    // the skinned meshes and clips of file, imported with flags like load_mesh in main.cpp
+    bool load(const char* file, GLuint texture, unsigned int flags) {
+        const aiScene* scene = aiImportFile(file, flags | aiProcess_Triangulate | aiProcess_LimitBoneWeights);
+        if (!scene) return false;
+        bool skinned = false;
+        for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+            skinned = skinned || scene->mMeshes[m]->HasBones();
+        if (!skinned || scene->mNumAnimations == 0) {
+            aiReleaseImport(scene);
+            return false;
+        }
+
+        ImportSkeleton(scene, skeleton);
+        std::vector<AnimationClip> imported;
+        ImportClips(scene, skeleton, imported);
+        size_t rawBytes = 0, compressedBytes = 0;
+        clips.clear();
+        for (const AnimationClip& clip : imported) {
+            clips.push_back(CompressClip(skeleton, clip));
+            rawBytes += ClipBytes(clip);
+            compressedBytes += clips.back().bytes();
+        }
+        std::vector<glm::vec3> positions, normals;
+        std::vector<glm::vec2> textureCoords;
+        std::vector<glm::ivec4> boneIds;
+        std::vector<glm::vec4> boneWeights;
+        for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+            const aiMesh* mesh = scene->mMeshes[m];
+            if (!mesh->HasBones()) continue;
+            for (unsigned int v = 0; v < mesh->mNumVertices; ++v) {
+                positions.push_back(glm::vec3(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z));
+                normals.push_back(mesh->HasNormals() ? glm::vec3(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z) : glm::vec3(0.0f, 1.0f, 0.0f));
+                textureCoords.push_back(mesh->HasTextureCoords(0) ? glm::vec2(mesh->mTextureCoords[0][v].x, mesh->mTextureCoords[0][v].y) : glm::vec2(0.0f));
+                boundingRadius = std::max(boundingRadius, glm::length(positions.back()));
+            }
+            ImportSkinWeights(mesh, skeleton, boneIds, boneWeights);
+        }
+        aiReleaseImport(scene);
+        if (positions.empty()) return false;
+        boundingRadius *= 1.5f;
+        vertexCount = positions.size();
+        textureId = texture;
+        scratch.resize(ThreadPool::Instance()->ThreadCount());
+        for (PoseScratch& s : scratch) s.resize(skeleton.jointCount());
+
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        glGenBuffers(5, vbos);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[0]);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[1]);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::vec3), normals.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[2]);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::vec2), textureCoords.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[3]);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::ivec4), boneIds.data(), GL_STATIC_DRAW);
+        glVertexAttribIPointer(5, 4, GL_INT, sizeof(glm::ivec4), (void*)0);
+        glEnableVertexAttribArray(5);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[4]);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(glm::vec4), boneWeights.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glEnableVertexAttribArray(6);
+
+        glGenBuffers(1, &instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STREAM_DRAW);
+        for (int i = 0; i < 2; i++) {
+            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(CompactTransform), (void*)(i * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(3 + i);
+            glVertexAttribDivisor(3 + i, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glGenBuffers(1, &paletteBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(JointMatrix), nullptr, GL_STREAM_DRAW);
+        glGenTextures(1, &paletteTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, paletteTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, paletteBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        // skinned on the CPU once per frame of the bake
+        std::vector<JointMatrix> palette(skeleton.jointCount());
+        int frames = std::min(std::max(static_cast<int>(clips[0].duration * 30.0f), 8), 120);
+        vat.bake(static_cast<int>(vertexCount), frames, [&](float cycle, glm::vec3* bakedPositions, glm::vec3* bakedNormals) {
+            SamplePalette(skeleton, clips[0], clips[0], cycle, 0.0f, scratch[0], palette.data());
+            for (size_t v = 0; v < vertexCount; ++v) {
+                glm::vec4 rows[3] = { glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f) };
+                for (int k = 0; k < 4; ++k)
+                    for (int r = 0; r < 3; ++r)
+                        rows[r] += boneWeights[v][k] * palette[boneIds[v][k]].rows[r];
+                glm::vec4 local(positions[v], 1.0f);
+                bakedPositions[v] = glm::vec3(glm::dot(rows[0], local), glm::dot(rows[1], local), glm::dot(rows[2], local));
+                glm::vec4 normal(normals[v], 0.0f);
+                bakedNormals[v] = glm::normalize(glm::vec3(glm::dot(rows[0], normal), glm::dot(rows[1], normal), glm::dot(rows[2], normal)));
+            }
+        });
+
+        std::cout << "Skinned " << file << ": " << skeleton.jointCount() << " joints, " << clips.size() << " clips, "
+            << rawBytes / 1024 << " KB of keys compressed to " << compressedBytes / 1024 << " KB" << std::endl;
+        loaded = true;
+        return true;
+    }
+
+    // Cull the instances, animate the visible ones at time seconds and upload their transforms and
+    // palettes. The phase an instance keeps in its bottom row (see FishRenderer::setPhase) spreads
+    // the instances over the cycle; with a second clip every instance drifts between the two.
+    // Playing the vertex animation texture leaves only the culling and the transforms to the CPU.
+    // Instances of a lower animation LOD tier are posed every second or fourth frame and hold their
+    // palette in between, while their transforms still move every frame.
+    void update(const std::vector<glm::mat4>& transforms, float time, const glm::mat4& viewProjection, bool vertexAnimation) {
+        const int joints = skeleton.jointCount();
+        visibleTransforms.resize(transforms.size());
+        visibleIndex.resize(transforms.size());
+        visibleCount = cullInstances(Frustum::FromMatrix(viewProjection), transforms.data(), transforms.size(), boundingRadius,
+            visibleTransforms.data(), visibleIndex.data());
+        packed.resize(visibleCount);
+        packTransforms(visibleTransforms.data(), packed.data(), visibleCount);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(CompactTransform), packed.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        if (vertexAnimation) return;
+
+        palettes.resize(visibleCount * joints);
+        AnimationLod* lod = AnimationLod::Instance();
+        AnimationLod::Thresholds thresholds = lod->thresholds(boundingRadius);
+        if (held.size() != transforms.size()) held.assign(transforms.size(), 0);
+        if (lod->enabled) heldPalettes.resize(transforms.size() * joints);
+        const CompressedClip& clipA = clips[0];
+        const CompressedClip& clipB = clips[clips.size() > 1 ? 1 : 0];
+        ThreadPool::Instance()->parallelFor(static_cast<int>(visibleCount), [&](int begin, int end, int chunk) {
+            for (int i = begin; i < end; ++i) {
+                float phase = visibleTransforms[i][0][3];
+                float cycle = time / clipA.duration + phase / glm::two_pi<float>();
+                cycle -= std::floor(cycle);
+                float blend = clips.size() > 1 ? 0.5f + 0.5f * std::sin(0.5f * time + phase) : 0.0f;
+                JointMatrix* palette = &palettes[size_t(i) * joints];
+                size_t id = visibleIndex[i];
+                int tier = thresholds.tier(lod->distanceSq(glm::vec3(visibleTransforms[i][3])));
+                if (tier == 0) {
+                    SamplePalette(skeleton, clipA, clipB, cycle, blend, scratch[chunk], palette);
+                    held[id] = 0;
+                    continue;
+                }
+                JointMatrix* heldPalette = &heldPalettes[id * joints];
+                if (!held[id] || lod->due(tier, static_cast<unsigned int>(id))) {
+                    SamplePalette(skeleton, clipA, clipB, cycle, blend, scratch[chunk], heldPalette);
+                    held[id] = 1;
+                }
+                std::copy(heldPalette, heldPalette + joints, palette);
+            }
+        });
+
+        glBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(palettes.size(), 1) * sizeof(JointMatrix), palettes.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void render(GLuint shaderProgram, bool vertexAnimation) {
+        if (visibleCount == 0) return;
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, paletteTexture);
+        glUniform1i(glGetUniformLocation(shaderProgram, "texture1"), 0);
+        glUniform1i(glGetUniformLocation(shaderProgram, "bonePalette"), 1);
+        glUniform1i(glGetUniformLocation(shaderProgram, "boneCount"), skeleton.jointCount());
+        glUniform1i(glGetUniformLocation(shaderProgram, "vertexAnimation"), vertexAnimation);
+        glUniform1f(glGetUniformLocation(shaderProgram, "clipDuration"), clips[0].duration);
+        if (vertexAnimation) vat.bind(shaderProgram, 2);
+
+        glBindVertexArray(vao);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, static_cast<GLsizei>(vertexCount), static_cast<GLsizei>(visibleCount));
+        glBindVertexArray(0);
+
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (vertexAnimation) vat.unbind(2);
+    }
+};
+
+// Skinned fish and crabs in place of the rigid meshes, for the models whose files carry bones and
+// animation clips. The fish follow the fish transforms, the crabs of a mesh the batch ActorWorld
+// gathered for it.
+class SkinnedCrowd {
+
+private:
+    SkinnedCrowd() {}
+
+    SkinnedCrowd(const SkinnedCrowd&) = delete;
+    SkinnedCrowd& operator=(const SkinnedCrowd&) = delete;
+public:
+
+    static SkinnedCrowd* Instance()
+    {
+        static SkinnedCrowd* instance = new SkinnedCrowd();
+        return instance;
+    }
+
+    bool enabled = false;
+    bool drawsFish = false;             // in place of FishRenderer, last frame
+    bool vertexAnimation = false;       // play the baked first clip instead of posing on the CPU
+    GLuint shaderProgram = 0;
+    SkinnedModel fish;
+    std::vector<SkinnedModel> crabs;    // by MeshHandle of the crab mesh, not loaded when it is rigid
+
+
+    void Init() {
+        shaderProgram = createShaderProgram("animationVertexShader.txt", "simpleFragmentShader.txt");
+        glUseProgram(shaderProgram);
+        // same light as the terrain shader
+        glUniform3f(glGetUniformLocation(shaderProgram, "lightAmbient"), 0.3f, 0.3f, 0.3f);
+        glUniform3f(glGetUniformLocation(shaderProgram, "lightDiffuse"), 1.5f, 1.5f, 1.5f);
+        glUniform1f(glGetUniformLocation(shaderProgram, "depthFalloff"), 0.00001f);
+        glUniform1f(glGetUniformLocation(shaderProgram, "causticIntensity"), 0.6f);
+        glUseProgram(0);
+    }
+
+    void loadFish(const char* file, GLuint texture) {
+        fish.load(file, texture, aiProcess_FlipUVs | aiProcess_GenSmoothNormals);
+    }
+
+    void loadCrab(MeshHandle mesh, const char* file, GLuint texture) {
+        if (crabs.size() <= mesh) crabs.resize(mesh + 1);
+        crabs[mesh].load(file, texture, aiProcess_GlobalScale);
+    }
+
+    // whether the entities of mesh are drawn skinned instead of by ActorWorld
+    bool drawsMesh(MeshHandle mesh) const {
+        return enabled && mesh < crabs.size() && crabs[mesh].loaded;
+    }
+
+    bool anyLoaded() const {
+        bool loaded = fish.loaded;
+        for (const SkinnedModel& crab : crabs) loaded = loaded || crab.loaded;
+        return loaded;
+    }
+
+    void setEnabled(bool value) {
+        if (value && !anyLoaded())
+        {
+            std::cout << "Skinned animation: no fish or crab file has bones and clips, keeping the rigid meshes" << std::endl;
+            return;
+        }
+        enabled = value;
+        std::cout << "Fish and crabs: " << (enabled ? "skinned" : "rigid") << std::endl;
+    }
+
+    // animate and upload, drawSkinnedFish is false while the circling fish are placed in the vertex shader
+    void update(const std::vector<glm::mat4>& fishTransforms, const std::vector<MeshAsset>& meshes, float time, const glm::mat4& viewProjection, bool drawSkinnedFish) {
+        drawsFish = fish.loaded && drawSkinnedFish;
+        if (drawsFish)
+            fish.update(fishTransforms, time, viewProjection, vertexAnimation);
+        else
+            fish.visibleCount = 0;
+        for (size_t mesh = 0; mesh < crabs.size() && mesh < meshes.size(); ++mesh) {
+            if (crabs[mesh].loaded) crabs[mesh].update(meshes[mesh].batch, time, viewProjection, vertexAnimation);
+        }
+    }
+
+    void render(const glm::mat4& proj, const glm::mat4& view, const glm::vec3& viewPos, const glm::vec3& lightDirection, float time) {
+        glUseProgram(shaderProgram);
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "proj"), 1, GL_FALSE, glm::value_ptr(proj));
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniform3f(glGetUniformLocation(shaderProgram, "viewPos"), viewPos.x, viewPos.y, viewPos.z);
+        glUniform3f(glGetUniformLocation(shaderProgram, "lightDirection"), lightDirection.x, lightDirection.y, lightDirection.z);
+        glUniform1f(glGetUniformLocation(shaderProgram, "timeInSeconds"), time);
+        if (fish.loaded) fish.render(shaderProgram, vertexAnimation);
+        for (SkinnedModel& crab : crabs)
+            if (crab.loaded) crab.render(shaderProgram, vertexAnimation);
+    }
+};
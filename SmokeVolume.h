@@ -0,0 +1,223 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <iostream>
+#include <GL/glew.h>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+
+#include "ParticleSystem.h"
+#include "ScreenPass.h"
+#include "ShaderUtility.h"
+#include "ThreadPool.h"
+
+// Alternative smoke renderer: live particles are splatted into a low resolution density grid around
+// the plume, uploaded as a 3D texture and raymarched in one screen pass. The fill cost depends on the
+// screen size and step count instead of the particle count and billboard overdraw. The splat reads
+// the particles on the CPU, so the volume follows the CPU and analytic backends but not the transform
+// feedback one, whose state never leaves the GPU.
+class SmokeVolume {
+
+private:
+    SmokeVolume() {}
+
+    SmokeVolume(const SmokeVolume&) = delete;
+    SmokeVolume& operator=(const SmokeVolume&) = delete;
+public:
+
+    static SmokeVolume* Instance()
+    {
+        static SmokeVolume* instance = new SmokeVolume();
+        return instance;
+    }
+
+    static constexpr int GRID_X = 64;
+    static constexpr int GRID_Y = 96;
+    static constexpr int GRID_Z = 64;
+    const int BLUR_RADIUS = 2;   // box blur in voxels, stands in for the billboard footprint
+    const int STEP_COUNT = 64;   // raymarch samples per pixel
+
+    bool enabled = false;
+    float densityScale = 1.0f;
+    glm::vec3 volumeMin, volumeMax, voxelSize;
+
+    std::vector<float> density, blurred;
+    std::vector<std::vector<float>> splatGrids; // one per thread chunk, summed after splatting
+    GLuint densityTexture;
+    GLuint shaderProgram;
+
+
+    void Init() {
+        // box around the plume: particles rise at most ~130 units and drift ~30 sideways
+        ParticleSystem* particleSystem = ParticleSystem::Instance();
+        volumeMin = particleSystem->startPosition + glm::vec3(-48.0f, -10.0f, -48.0f);
+        volumeMax = particleSystem->startPosition + glm::vec3(48.0f, 150.0f, 48.0f);
+        voxelSize = (volumeMax - volumeMin) / glm::vec3(GRID_X, GRID_Y, GRID_Z);
+
+        density.assign(voxelCount(), 0.0f);
+        blurred.assign(voxelCount(), 0.0f);
+        splatGrids.assign(ThreadPool::Instance()->ThreadCount(), std::vector<float>(voxelCount(), 0.0f));
+
+        glGenTextures(1, &densityTexture);
+        glBindTexture(GL_TEXTURE_3D, densityTexture);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R16F, GRID_X, GRID_Y, GRID_Z, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        shaderProgram = createShaderProgram("screenVertexShader.txt", "smokeVolumeFragmentShader.txt");
+        screenPass::Init();
+    }
+
+    int voxelCount() const { return GRID_X * GRID_Y * GRID_Z; }
+    int voxelIndex(int x, int y, int z) const { return (z * GRID_Y + y) * GRID_X + x; }
+
+    void setEnabled(bool value) {
+        // the splat reads particle positions on the CPU
+        if (value && !ParticleSystem::Instance()->cpuReadable())
+        {
+            std::cout << "Smoke renderer: the density volume needs the CPU or analytic particle backend" << std::endl;
+            value = false;
+        }
+        enabled = value;
+        std::cout << "Smoke renderer: " << (enabled ? "density volume" : "billboards") << std::endl;
+    }
+
+    // Rebuild the density grid from the current particles and upload it
+    void update() {
+        // switching to transform feedback takes the positions off the CPU, fall back to billboards
+        if (!ParticleSystem::Instance()->cpuReadable())
+        {
+            setEnabled(false);
+            return;
+        }
+
+        splatParticles();
+
+        // separable blur, density -> blurred -> density -> blurred
+        blurAxis(density, blurred, 0);
+        blurAxis(blurred, density, 1);
+        blurAxis(density, blurred, 2);
+
+        glBindTexture(GL_TEXTURE_3D, densityTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, GRID_X, GRID_Y, GRID_Z, GL_RED, GL_FLOAT, blurred.data());
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    void splatParticles() {
+        ParticleSystem* particleSystem = ParticleSystem::Instance();
+        ThreadPool* pool = ThreadPool::Instance();
+
+        // each chunk splats into its own grid, so no atomics are needed
+        int chunks = pool->parallelFor(particleSystem->NUM_PARTICLES, [&](int begin, int end, int chunk) {
+            std::vector<float>& grid = splatGrids[chunk];
+            for (int i = begin; i < end; ++i) {
+                glm::vec3 position;
+                float percent;
+                if (!particleSystem->liveParticle(i, position, percent)) continue;
+
+                // same opacity and quad size as the billboard shaders
+                float alpha = std::sqrt(percent);
+                float size = 0.1f * glm::mix(50.0f, 150.0f, std::pow(percent, 1.5f));
+                float mass = alpha * size * size;
+
+                // trilinear splat into the 8 surrounding voxel centres
+                glm::vec3 g = (position - volumeMin) / voxelSize - glm::vec3(0.5f);
+                int x0 = static_cast<int>(std::floor(g.x));
+                int y0 = static_cast<int>(std::floor(g.y));
+                int z0 = static_cast<int>(std::floor(g.z));
+                glm::vec3 f = g - glm::vec3(x0, y0, z0);
+                for (int dz = 0; dz < 2; ++dz) {
+                    int z = z0 + dz;
+                    if (z < 0 || z >= GRID_Z) continue;
+                    float wz = dz ? f.z : 1.0f - f.z;
+                    for (int dy = 0; dy < 2; ++dy) {
+                        int y = y0 + dy;
+                        if (y < 0 || y >= GRID_Y) continue;
+                        float wy = dy ? f.y : 1.0f - f.y;
+                        for (int dx = 0; dx < 2; ++dx) {
+                            int x = x0 + dx;
+                            if (x < 0 || x >= GRID_X) continue;
+                            float wx = dx ? f.x : 1.0f - f.x;
+                            grid[voxelIndex(x, y, z)] += wx * wy * wz * mass;
+                        }
+                    }
+                }
+            }
+        });
+
+        // sum the chunk grids into density and clear them for the next frame
+        const float inverseVoxelVolume = 1.0f / (voxelSize.x * voxelSize.y * voxelSize.z);
+        pool->parallelFor(voxelCount(), [&](int begin, int end, int) {
+            for (int v = begin; v < end; ++v) {
+                float sum = 0.0f;
+                for (int c = 0; c < chunks; ++c) {
+                    sum += splatGrids[c][v];
+                    splatGrids[c][v] = 0.0f;
+                }
+                density[v] = sum * inverseVoxelVolume;
+            }
+        });
+    }
+
+    // box blur along one axis (0 = x, 1 = y, 2 = z), parallel over z slices
+    void blurAxis(const std::vector<float>& src, std::vector<float>& dst, int axis) {
+        const int size[3] = { GRID_X, GRID_Y, GRID_Z };
+        const int stride[3] = { 1, GRID_X, GRID_X * GRID_Y };
+        const float weight = 1.0f / (2 * BLUR_RADIUS + 1);
+
+        ThreadPool::Instance()->parallelFor(GRID_Z, [&](int begin, int end, int) {
+            for (int z = begin; z < end; ++z) {
+                for (int y = 0; y < GRID_Y; ++y) {
+                    for (int x = 0; x < GRID_X; ++x) {
+                        const int coord[3] = { x, y, z };
+                        int index = voxelIndex(x, y, z);
+                        float sum = 0.0f;
+                        for (int k = -BLUR_RADIUS; k <= BLUR_RADIUS; ++k) {
+                            int c = coord[axis] + k;
+                            if (c < 0 || c >= size[axis]) continue;
+                            sum += src[index + k * stride[axis]];
+                        }
+                        dst[index] = sum * weight;
+                    }
+                }
+            }
+        });
+    }
+
+    // Raymarch the density over the opaque scene, call after the opaque pass
+    void render() {
+        GLuint sceneDepth = screenPass::CopySceneDepth();
+        glm::mat4 inverseViewProjection = glm::inverse(persp_proj * view);
+
+        glUseProgram(shaderProgram);
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+        glUniform3f(glGetUniformLocation(shaderProgram, "viewPos"), cameraPosition.x, cameraPosition.y, cameraPosition.z);
+        glUniform3fv(glGetUniformLocation(shaderProgram, "volumeMin"), 1, glm::value_ptr(volumeMin));
+        glUniform3fv(glGetUniformLocation(shaderProgram, "volumeMax"), 1, glm::value_ptr(volumeMax));
+        glUniform1f(glGetUniformLocation(shaderProgram, "densityScale"), densityScale);
+        glUniform1i(glGetUniformLocation(shaderProgram, "stepCount"), STEP_COUNT);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, densityTexture);
+        glUniform1i(glGetUniformLocation(shaderProgram, "densityVolume"), 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, sceneDepth);
+        glUniform1i(glGetUniformLocation(shaderProgram, "sceneDepth"), 1);
+
+        // premultiplied colour over the scene, the shader stops the rays at the scene depth itself
+        glDisable(GL_DEPTH_TEST);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        screenPass::Draw();
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glEnable(GL_DEPTH_TEST);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+};
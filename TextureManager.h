@@ -1,6 +1,9 @@
 #pragma once
 #include <unordered_map>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
 #include <GL/glew.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -80,6 +83,85 @@ public:
         return textureID;
     }
 
+    // One RGBA texture array layer per image. Layers share a size, the largest width and height of the
+    // images, smaller images are scaled up to it bilinearly.
+    GLuint LoadTextureArray(const std::vector<string>& paths) {
+        string key = "array";
+        for (const string& path : paths) key += "|" + path;
+        if (textureCache.find(key) != textureCache.end()) {
+            return textureCache[key];
+        }
+
+        const int count = static_cast<int>(paths.size());
+        std::vector<unsigned char*> images(count, nullptr);
+        std::vector<int> widths(count, 0), heights(count, 0);
+        int layerWidth = 0, layerHeight = 0;
+        for (int i = 0; i < count; ++i) {
+            int nrChannels;
+            images[i] = stbi_load(paths[i].c_str(), &widths[i], &heights[i], &nrChannels, 4);
+            if (!images[i]) {
+                std::cerr << "Failed to load texture: " << paths[i] << std::endl;
+                continue;
+            }
+            layerWidth = std::max(layerWidth, widths[i]);
+            layerHeight = std::max(layerHeight, heights[i]);
+        }
+        if (layerWidth == 0) return 0;
+
+        // a missing image leaves its layer white
+        std::vector<unsigned char> layers(size_t(layerWidth) * layerHeight * 4 * count, 255);
+        for (int i = 0; i < count; ++i) {
+            if (!images[i]) continue;
+            unsigned char* target = &layers[size_t(layerWidth) * layerHeight * 4 * i];
+            if (widths[i] == layerWidth && heights[i] == layerHeight) {
+                std::copy(images[i], images[i] + size_t(layerWidth) * layerHeight * 4, target);
+            }
+            else {
+                std::cout << "Texture array: " << paths[i] << " scaled from " << widths[i] << " x " << heights[i]
+                    << " to " << layerWidth << " x " << layerHeight << std::endl;
+                ResampleBilinear(images[i], widths[i], heights[i], target, layerWidth, layerHeight);
+            }
+            stbi_image_free(images[i]);
+        }
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, layerWidth, layerHeight, count, 0, GL_RGBA, GL_UNSIGNED_BYTE, layers.data());
+        textureCache[key] = textureID;
+
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        return textureID;
+    }
+
+    // RGBA image to another size, texel centres mapped onto each other, wrapping like GL_REPEAT
+    static void ResampleBilinear(const unsigned char* source, int sourceWidth, int sourceHeight, unsigned char* target, int width, int height) {
+        for (int y = 0; y < height; ++y) {
+            float sy = (y + 0.5f) * sourceHeight / height - 0.5f;
+            int y0 = int(std::floor(sy));
+            float fy = sy - y0;
+            int rows[2] = { (y0 % sourceHeight + sourceHeight) % sourceHeight, ((y0 + 1) % sourceHeight + sourceHeight) % sourceHeight };
+            for (int x = 0; x < width; ++x) {
+                float sx = (x + 0.5f) * sourceWidth / width - 0.5f;
+                int x0 = int(std::floor(sx));
+                float fx = sx - x0;
+                int cols[2] = { (x0 % sourceWidth + sourceWidth) % sourceWidth, ((x0 + 1) % sourceWidth + sourceWidth) % sourceWidth };
+                for (int c = 0; c < 4; ++c) {
+                    float top = source[(size_t(rows[0]) * sourceWidth + cols[0]) * 4 + c] * (1.0f - fx) + source[(size_t(rows[0]) * sourceWidth + cols[1]) * 4 + c] * fx;
+                    float bottom = source[(size_t(rows[1]) * sourceWidth + cols[0]) * 4 + c] * (1.0f - fx) + source[(size_t(rows[1]) * sourceWidth + cols[1]) * 4 + c] * fx;
+                    target[(size_t(y) * width + x) * 4 + c] = static_cast<unsigned char>(top * (1.0f - fy) + bottom * fy + 0.5f);
+                }
+            }
+        }
+    }
+
     void Clear() {
         for (auto& pair : textureCache) {
             glDeleteTextures(1, &pair.second);
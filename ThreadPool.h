@@ -0,0 +1,103 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+// Persistent worker threads for data parallel loops (smoke splatting, lava, flocking...).
+// The calling thread works on a chunk too, so ThreadCount() = workers + 1.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::mutex dispatchMutex;              // one parallelFor at a time, callers may live on different threads
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    // current job, guarded by mutex
+    const std::function<void(int, int, int)>* currentTask = nullptr;
+    int taskCount = 0;
+    int taskChunks = 0;
+    int nextChunk = 0;
+    int remaining = 0;
+    int activeThreads = 0;                 // upper bound on chunks per parallelFor, for scaling measurements
+
+    ThreadPool() {
+        int hardwareThreads = static_cast<int>(std::thread::hardware_concurrency());
+        int workerCount = std::max(hardwareThreads - 1, 0);
+        for (int i = 0; i < workerCount; ++i) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+        activeThreads = ThreadCount();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // run chunks of the current job until none are left, mutex must be held
+    void runChunks(std::unique_lock<std::mutex>& lock) {
+        while (nextChunk < taskChunks) {
+            int chunk = nextChunk++;
+            const auto* task = currentTask;
+            int begin = static_cast<int>(static_cast<long long>(taskCount) * chunk / taskChunks);
+            int end = static_cast<int>(static_cast<long long>(taskCount) * (chunk + 1) / taskChunks);
+            lock.unlock();
+            (*task)(begin, end, chunk);
+            lock.lock();
+            if (--remaining == 0) {
+                done.notify_all();
+            }
+        }
+    }
+
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return nextChunk < taskChunks; });
+            runChunks(lock);
+        }
+    }
+
+public:
+    static ThreadPool* Instance()
+    {
+        static ThreadPool* instance = new ThreadPool();
+        return instance;
+    }
+
+    int ThreadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+    // limit later parallelFor calls to count threads, clamped to [1, ThreadCount()]
+    void SetActiveThreadCount(int count) { activeThreads = std::max(1, std::min(count, ThreadCount())); }
+    int ActiveThreadCount() const { return activeThreads; }
+
+    // Split [0, count) into at most ActiveThreadCount() contiguous ranges and run task(begin, end, chunk) on
+    // them in parallel. chunk is unique within the call and below ActiveThreadCount(), itself at most
+    // ThreadCount(), so it can index per thread scratch data. Blocks until every range is done and returns the number of chunks used.
+    // Must not be called from inside a task.
+    int parallelFor(int count, const std::function<void(int, int, int)>& task) {
+        if (count <= 0) return 0;
+        int chunks = std::min(count, activeThreads);
+        if (chunks == 1) {
+            task(0, count, 0);
+            return 1;
+        }
+
+        std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+        std::unique_lock<std::mutex> lock(mutex);
+        currentTask = &task;
+        taskCount = count;
+        taskChunks = chunks;
+        nextChunk = 0;
+        remaining = chunks;
+        wake.notify_all();
+
+        runChunks(lock);
+        done.wait(lock, [this] { return remaining == 0; });
+        taskChunks = 0;
+        currentTask = nullptr;
+        return chunks;
+    }
+};
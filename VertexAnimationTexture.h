@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+#include <GL/glew.h>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+
+// A looping animation baked into two textures of per frame vertex positions and normals, for crowds
+// too large to animate on the CPU. Texel x is the vertex, texel y the frame, so the vertex shader gets
+// a vertex between two frames with one linearly filtered fetch per texture and no pose evaluation.
+// Meshes wider than MAX_WIDTH vertices are split into blocks of rows stacked below each other. Every
+// block repeats its first frame after the last one, so the loop interpolates back to the start.
+// Positions are 16 bit fractions of their bounds over the loop, which unlike half floats keep the same
+// precision however far the mesh lies from its origin. Normals are half floats.
+// vatCoord in simpleVertexShader.txt and animationVertexShader.txt does the lookup.
+struct VertexAnimationTexture {
+    static constexpr int MAX_WIDTH = 4096;
+
+    GLuint positionTexture = 0, normalTexture = 0;
+    int vertexCount = 0, frameCount = 0;
+    int width = 0, height = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f), boundsSize = glm::vec3(1.0f);  // of the positions over all frames
+
+    bool baked() const { return positionTexture != 0; }
+
+    // frame(cycle, positions, normals) writes every vertex at cycle, the fraction of the loop in [0, 1)
+    void bake(int vertices, int frames, const std::function<void(float, glm::vec3*, glm::vec3*)>& frame) {
+        vertexCount = vertices;
+        frameCount = frames;
+        width = std::min(vertexCount, MAX_WIDTH);
+        int blocks = (vertexCount + width - 1) / width;
+        height = blocks * (frameCount + 1);
+
+        std::vector<glm::vec4> positionTexels(size_t(width) * height), normalTexels(size_t(width) * height);
+        std::vector<glm::vec3> positions(vertexCount), normals(vertexCount);
+        glm::vec3 boundsMax(-1e30f);
+        boundsMin = glm::vec3(1e30f);
+        for (int f = 0; f < frameCount; ++f) {
+            frame(float(f) / frameCount, positions.data(), normals.data());
+            for (int v = 0; v < vertexCount; ++v) {
+                boundsMin = glm::min(boundsMin, positions[v]);
+                boundsMax = glm::max(boundsMax, positions[v]);
+                int block = v / width;
+                for (int row : { f, f == 0 ? frameCount : -1 }) {
+                    if (row < 0) continue;
+                    size_t texel = size_t(block * (frameCount + 1) + row) * width + (v - block * width);
+                    positionTexels[texel] = glm::vec4(positions[v], 1.0f);
+                    normalTexels[texel] = glm::vec4(normals[v], 0.0f);
+                }
+            }
+        }
+
+        boundsSize = glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+        std::vector<uint16_t> positionFractions(positionTexels.size() * 4);
+        for (size_t texel = 0; texel < positionTexels.size(); ++texel) {
+            glm::vec3 fraction = glm::clamp((glm::vec3(positionTexels[texel]) - boundsMin) / boundsSize, 0.0f, 1.0f);
+            for (int i = 0; i < 3; ++i)
+                positionFractions[texel * 4 + i] = uint16_t(fraction[i] * 65535.0f + 0.5f);
+            positionFractions[texel * 4 + 3] = 65535;
+        }
+
+        auto upload = [&](GLuint& texture, GLint format, GLenum type, const void* texels) {
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, type, texels);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        };
+        upload(positionTexture, GL_RGBA16, GL_UNSIGNED_SHORT, positionFractions.data());
+        upload(normalTexture, GL_RGBA16F, GL_FLOAT, normalTexels.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        std::cout << "Vertex animation texture: " << vertexCount << " vertices, " << frameCount << " frames, "
+            << width << "x" << height << ", " << size_t(width) * height * 16 / 1024 << " KB" << std::endl;
+    }
+
+    // positions on texture unit firstUnit, normals on the next one
+    void bind(GLuint shaderProgram, int firstUnit) const {
+        glActiveTexture(GL_TEXTURE0 + firstUnit);
+        glBindTexture(GL_TEXTURE_2D, positionTexture);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+        glBindTexture(GL_TEXTURE_2D, normalTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(shaderProgram, "vatPositions"), firstUnit);
+        glUniform1i(glGetUniformLocation(shaderProgram, "vatNormals"), firstUnit + 1);
+        glUniform1i(glGetUniformLocation(shaderProgram, "vatFrames"), frameCount);
+        glUniform3fv(glGetUniformLocation(shaderProgram, "vatBoundsMin"), 1, glm::value_ptr(boundsMin));
+        glUniform3fv(glGetUniformLocation(shaderProgram, "vatBoundsSize"), 1, glm::value_ptr(boundsSize));
+    }
+
+    void unbind(int firstUnit) const {
+        for (int unit = firstUnit; unit < firstUnit + 2; ++unit) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <iostream>
+#include <GL/glew.h>
+#include <glm.hpp>
+
+#include "ProgramSetting.h"
+#include "ScreenPass.h"
+#include "ShaderUtility.h"
+
+// Weighted blended order-independent transparency (McGuire & Bavoil). Transparent draws between
+// begin() and end() accumulate into two targets in any order, end() resolves them over the backbuffer.
+// Both targets share one glBlendFuncSeparate, so no per target blending (GL 4.0) is needed: the colour
+// channels add up and the alpha channel multiplies by 1 - alpha, which makes the revealage. Shaders
+// drawn in between must write both outputs, see the weightedOIT branch in particleFragmentShader.txt
+// and fogFragmentShader.txt.
+class WeightedOIT {
+
+private:
+    WeightedOIT() {}
+
+    WeightedOIT(const WeightedOIT&) = delete;
+    WeightedOIT& operator=(const WeightedOIT&) = delete;
+public:
+
+    static WeightedOIT* Instance()
+    {
+        static WeightedOIT* instance = new WeightedOIT();
+        return instance;
+    }
+
+    GLuint framebuffer = 0;
+    GLuint accumTexture = 0;      // rgb = sum of weighted premultiplied colour, a = revealage, product of (1 - alpha)
+    GLuint weightTexture = 0;     // sum of weighted alpha
+    GLuint resolveProgram;
+
+
+    void Init() {
+        if (framebuffer != 0)
+            return;
+        screenPass::Init();
+        resolveProgram = createShaderProgram("screenVertexShader.txt", "oitResolveFragmentShader.txt");
+
+        glGenTextures(1, &accumTexture);
+        glBindTexture(GL_TEXTURE_2D, accumTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenTextures(1, &weightTexture);
+        glBindTexture(GL_TEXTURE_2D, weightTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // depth test against the copied scene depth, transparent draws never write it
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, weightTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, screenPass::sceneDepthTexture, 0);
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cerr << "Weighted OIT framebuffer is incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Start collecting transparent draws, call after the opaque pass
+    void begin() {
+        screenPass::CopySceneDepth();
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        const GLfloat clearAccum[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        const GLfloat clearWeight[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, clearAccum);
+        glClearBufferfv(GL_COLOR, 1, clearWeight);
+
+        // colour += source colour, alpha *= 1 - source alpha
+        glDepthMask(GL_FALSE);
+        glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    // Composite the average transparent colour over the backbuffer
+    void end() {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDepthMask(GL_TRUE);
+
+        glUseProgram(resolveProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, accumTexture);
+        glUniform1i(glGetUniformLocation(resolveProgram, "accumTexture"), 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, weightTexture);
+        glUniform1i(glGetUniformLocation(resolveProgram, "weightTexture"), 1);
+
+        // colour * (1 - revealage) + scene * revealage
+        glDisable(GL_DEPTH_TEST);
+        glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+        screenPass::Draw();
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glEnable(GL_DEPTH_TEST);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
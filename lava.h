@@ -1,8 +1,123 @@
 #pragma once
 #include "ModelStructure.h"
+#include "LavaHeightField.h"
+#include "Benchmark.h"
+
+// lava wave parameters, shared with simpleVertexShader.txt when the lava is displaced on the GPU
+const float lavaFrequency = 0.1f;
+const float lavaAmplitude = 2.0f;
+const float lavaPhaseShift = 0.3f;
+
+// displace the lava in the vertex shader instead of updating the vertex buffer every frame
+bool lavaOnGPU = false;
+
+// the waves of generateHeight
+LavaWaveModel DefaultLavaWaves() {
+    LavaWaveModel model;
+    model.xWaves.push_back({ lavaAmplitude, lavaFrequency, 1.0f, 0.0f, false, 0.0f });
+    model.zWaves.push_back({ lavaAmplitude, lavaFrequency, lavaPhaseShift, 0.0f, true, 0.0f });
+    return model;
+}
+
+// generateHeight plus finer octaves, each at double frequency and half amplitude
+LavaWaveModel OctaveLavaWaves(int octaves) {
+    LavaWaveModel model = DefaultLavaWaves();
+    for (int i = 1; i < octaves; ++i) {
+        float scale = float(1 << i);
+        model.xWaves.push_back({ lavaAmplitude / scale, lavaFrequency * scale, 1.0f + 0.3f * i, 1.7f * i, false, 0.0f });
+        model.zWaves.push_back({ lavaAmplitude / scale, lavaFrequency * scale, lavaPhaseShift + 0.2f * i, 0.9f * i, true, 0.0f });
+    }
+    return model;
+}
+
+// generateHeight with sharpened crests
+LavaWaveModel GerstnerLavaWaves() {
+    LavaWaveModel model = DefaultLavaWaves();
+    model.xWaves[0].steepness = 0.6f;
+    model.zWaves[0].steepness = 0.6f;
+    return model;
+}
+
+// CPU lava kernel, set its waves to OctaveLavaWaves or GerstnerLavaWaves for a rougher surface
+LavaHeightField lavaHeightField;
+
+// quads per strip band: a band row touches 2 * (band + 1) vertices, small enough that the row
+// below still finds its shared vertices in the post transform cache
+const int lavaStripBand = 16;
+
+// Append the indices of the quads [quadRowBegin, quadRowEnd) x [quadColBegin, quadColEnd) of a grid
+// with cols vertices per row. Strips end every row with the restart index.
+template <typename Index>
+void appendQuadIndices(vector<Index>& indices, int cols, int quadRowBegin, int quadRowEnd, int quadColBegin, int quadColEnd,
+    GLenum primitive, Index restartIndex) {
+    for (int z = quadRowBegin; z < quadRowEnd; ++z) {
+        if (primitive == GL_TRIANGLE_STRIP) {
+            for (int x = quadColBegin; x <= quadColEnd; ++x) {
+                indices.push_back(Index(z * cols + x));
+                indices.push_back(Index((z + 1) * cols + x));
+            }
+            indices.push_back(restartIndex);
+            continue;
+        }
+        for (int x = quadColBegin; x < quadColEnd; ++x) {
+            // the four corners of the current cell
+            Index topLeft = Index(z * cols + x);
+            Index topRight = Index(topLeft + 1);
+            Index bottomLeft = Index((z + 1) * cols + x);
+            Index bottomRight = Index(bottomLeft + 1);
+
+            // two triangles, same winding as the strip
+            indices.push_back(topLeft);
+            indices.push_back(bottomLeft);
+            indices.push_back(topRight);
+
+            indices.push_back(topRight);
+            indices.push_back(bottomLeft);
+            indices.push_back(bottomRight);
+        }
+    }
+}
+
+// Append the indices of a rows x cols vertex grid, exactly (rows - 1) x (cols - 1) quads.
+// The grid is walked in column bands so neighbouring rows share cached vertices.
+template <typename Index>
+void appendGridIndices(vector<Index>& indices, int rows, int cols, GLenum primitive, Index restartIndex) {
+    for (int bandStart = 0; bandStart < cols - 1; bandStart += lavaStripBand) {
+        int bandEnd = std::min(bandStart + lavaStripBand, cols - 1);
+        appendQuadIndices(indices, cols, 0, rows - 1, bandStart, bandEnd, primitive, restartIndex);
+    }
+    // the last strip needs no restart
+    if (primitive == GL_TRIANGLE_STRIP && !indices.empty())
+        indices.pop_back();
+}
+
+// Append a block of quads to a grid mesh in its index type, returns the number of indices added
+size_t appendGridBlock(ModelData& mesh, int cols, int quadRowBegin, int quadRowEnd, int quadColBegin, int quadColEnd) {
+    size_t before = mesh.IndexCount();
+    if (mesh.mIndexType == GL_UNSIGNED_SHORT)
+        appendQuadIndices<unsigned short>(mesh.mIndices16, cols, quadRowBegin, quadRowEnd, quadColBegin, quadColEnd, mesh.mPrimitive, 0xFFFF);
+    else
+        appendQuadIndices<unsigned int>(mesh.mIndices, cols, quadRowBegin, quadRowEnd, quadColBegin, quadColEnd, mesh.mPrimitive, 0xFFFFFFFF);
+    return mesh.IndexCount() - before;
+}
+
+// Fill the index buffer of a grid mesh, 16 bit indices whenever the vertex count leaves room for the restart index
+void generateGridIndices(ModelData& mesh, int rows, int cols, GLenum primitive) {
+    mesh.mPrimitive = primitive;
+    mesh.mIndices.clear();
+    mesh.mIndices16.clear();
+    if (rows * cols < 0xFFFF) {
+        mesh.mIndexType = GL_UNSIGNED_SHORT;
+        appendGridIndices<unsigned short>(mesh.mIndices16, rows, cols, primitive, 0xFFFF);
+    }
+    else {
+        mesh.mIndexType = GL_UNSIGNED_INT;
+        appendGridIndices<unsigned int>(mesh.mIndices, rows, cols, primitive, 0xFFFFFFFF);
+    }
+}
 
 // generate lava plane with vertices, normals, uvs
-ModelData generateLavaPlane(float width, float depth, int rows, int cols) {
+ModelData generateLavaPlane(float width, float depth, int rows, int cols, GLenum primitive = GL_TRIANGLE_STRIP) {
     ModelData lavaPlane;
 
     float dx = width / (cols - 1);
@@ -22,62 +137,67 @@ ModelData generateLavaPlane(float width, float depth, int rows, int cols) {
 
             // texture coordinates
             lavaPlane.mTextureCoords.push_back(glm::vec2(float(x) / (float)(cols - 1), float(z) / (float)(rows - 1)));
-
-            // Calculate the indices of the four corners of the current cell
-            unsigned int topLeft = z * cols + x;
-            unsigned int topRight = topLeft + 1;
-            unsigned int bottomLeft = (z + 1) * cols + x;
-            unsigned int bottomRight = bottomLeft + 1;
-
-            // Add the two triangles for this cell
-            lavaPlane.mIndices.push_back(topLeft);
-            lavaPlane.mIndices.push_back(bottomLeft);
-            lavaPlane.mIndices.push_back(topRight);
-
-            lavaPlane.mIndices.push_back(topRight);
-            lavaPlane.mIndices.push_back(bottomLeft);
-            lavaPlane.mIndices.push_back(bottomRight);
         }
     }
+    generateGridIndices(lavaPlane, rows, cols, primitive);
     lavaPlane.mPointCount = lavaPlane.mVertices.size();
     return lavaPlane;
 }
 
-vector<unsigned int> generateGridIndices(int rows, int cols) {
-    vector<unsigned int> indices;
-
-    for (int z = 0; z < rows - 1; ++z) {
-        for (int x = 0; x < cols - 1; ++x) {
-            
-        }
-    }
-    return indices;
-}
-
-
 float generateHeight(float x, float z, float time) 
 {
-    float frequency = 0.1f;  
-    float amplitude = 2.0f;   
-    float phaseShift = 0.3f;  
     // summation of two sinosoidal waves
-    return amplitude * (sin(frequency * x + time) + cos(frequency * z + time * phaseShift));
+    return lavaAmplitude * (sin(lavaFrequency * x + time) + cos(lavaFrequency * z + time * lavaPhaseShift));
 }
 
 void updatePlaneVerticesWithHeight(ModelData& lava, int rows, int cols, float time) {
-    int index = 0;
-    for (int z = 0; z < rows; ++z) {
-        for (int x = 0; x < cols; ++x) {
-            float px = lava.mVertices[index].x;
-            float pz = lava.mVertices[index].z;
-            lava.mVertices[index].y = generateHeight(px, pz, time);
-            index++;
-        }
+    if (lavaHeightField.rows != rows || lavaHeightField.cols != cols)
+    {
+        if (lavaHeightField.waves.xWaves.empty() && lavaHeightField.waves.zWaves.empty())
+            lavaHeightField.waves = DefaultLavaWaves();
+        lavaHeightField.init(rows, cols, lava.mVertices);
     }
+    lavaHeightField.update(time);
+    lavaHeightField.writeRows(lava, 0, rows);
 
-    // update lava vertex buffer
+    // update lava vertex and normal buffers
     glBindBuffer(GL_ARRAY_BUFFER, lava.mVBOs[0]);
     glBufferSubData(GL_ARRAY_BUFFER, 0, lava.mVertices.size() * sizeof(glm::vec3), lava.mVertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, lava.mVBOs[1]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, lava.mNormals.size() * sizeof(glm::vec3), lava.mNormals.data());
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-}
\ No newline at end of file
+}
+
+// Compare the old per vertex generateHeight loop with the separable kernel, no GL needed
+void benchmarkLavaKernel() {
+    const int sizes[] = { 100, 256, 512, 1024, 2048 };
+    for (int size : sizes) {
+        ModelData plane = generateLavaPlane(lavaWidth, lavaWidth, size, size);
+        int iterations = std::max(1, 4000000 / (size * size));
+        std::cout << "Lava grid " << size << "x" << size << std::endl;
+
+        float time = 0.0f;
+        benchmark::Measure("per vertex generateHeight", iterations, [&]() {
+            for (glm::vec3& vertex : plane.mVertices)
+                vertex.y = generateHeight(vertex.x, vertex.z, time);
+            time += 0.01f;
+        });
+
+        const std::pair<const char*, LavaWaveModel> models[] = {
+            { "separable kernel", DefaultLavaWaves() },
+            { "separable kernel, 4 octaves", OctaveLavaWaves(4) },
+            { "separable kernel, Gerstner", GerstnerLavaWaves() },
+        };
+        for (const auto& model : models) {
+            LavaHeightField field;
+            field.waves = model.second;
+            field.init(size, size, plane.mVertices);
+            benchmark::Measure(model.first, iterations, [&]() {
+                field.update(time);
+                field.writeRows(plane, 0, size);
+                time += 0.01f;
+            });
+        }
+    }
+}
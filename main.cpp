@@ -36,6 +36,18 @@ namespace fs = std::filesystem;
 #include "ProgramSetting.h"
 #include "ModelStructure.h"
 #include "lava.h"
+#include "LavaLod.h"
+#include "LavaTiles.h"
+#include "LavaWorker.h"
+#include "LavaFlow.h"
+#include "FishSchool.h"
+#include "FishRenderer.h"
+#include "SkinnedCrowd.h"
+#include "ActorWorld.h"
+#include "Seabed.h"
+#include "ActorCollision.h"
+#include "PickingBvh.h"
+#include "SmokeVolume.h"
 #include <functional>
 
 /*----------------------------------------------------------------------------
@@ -62,6 +74,18 @@ float timeInSeconds = 0.0f;
 
 GLuint terrianShaderProgramID;
 
+// archetypes of the actors, see ActorWorld.h
+const unsigned int CRAB_ACTOR = COMPONENT_TRANSFORM | COMPONENT_VELOCITY | COMPONENT_BEHAVIOUR | COMPONENT_RENDER_MESH | COMPONENT_GROUNDED;
+const unsigned int CIRCLING_FISH = COMPONENT_ORBIT | COMPONENT_RENDER_MESH;
+const unsigned int SCHOOL_FISH = COMPONENT_SCHOOL | COMPONENT_RENDER_MESH;
+MeshHandle fishMesh = 0;
+
+// model matrices of the fish that swim, the school while it is on, otherwise the circling fish
+vector<glm::mat4>& fishTransforms()
+{
+	return ActorWorld::Instance()->archetype(FishSchool::Instance()->enabled ? SCHOOL_FISH : CIRCLING_FISH).matrices;
+}
+
 // all the meshes in the scene
 
 //ModelData smoke_mesh;
@@ -239,6 +263,9 @@ GLuint CompileTerrianShader()
 	glUniform3f(glGetUniformLocation(terrianShaderProgramID, "lightDiffuse"), 1.5f, 1.5f, 1.5f);
 	glUniform1f(glGetUniformLocation(terrianShaderProgramID, "depthFalloff"), 0.00001f);
 	glUniform1f(glGetUniformLocation(terrianShaderProgramID, "causticIntensity"), 0.6f);
+	glUniform1f(glGetUniformLocation(terrianShaderProgramID, "lavaFrequency"), lavaFrequency);
+	glUniform1f(glGetUniformLocation(terrianShaderProgramID, "lavaAmplitude"), lavaAmplitude);
+	glUniform1f(glGetUniformLocation(terrianShaderProgramID, "lavaPhaseShift"), lavaPhaseShift);
 	return terrianShaderProgramID;
 }
 #pragma endregion SHADER_FUNCTIONS
@@ -300,17 +327,32 @@ inline void CalcFishInstanceTransform(const FishInstance& fish, glm::mat4& trans
 
 void InitializeFishInstances() 
 {
-	fishInstanceTransforms.resize(FISHCOUNT, glm::mat4(1.0f));
-
+	ActorWorld* world = ActorWorld::Instance();
 	for (float i = 0; i < FISHCOUNT; ++i)
 	{
-		FishInstance instance;
+		Entity entity = world->create(CIRCLING_FISH);
+		Archetype& fish = world->archetypeOf(entity);
+		size_t row = world->rowOf(entity);
+		FishInstance& instance = fish.orbits[row];
 		instance.angle = 0.3f * glm::two_pi<float>() * i;
 		instance.speed = 0.075f;
 		instance.radius = 40.f + 1.f * i;
 		instance.y = 40.f + 5.f * i;
-		CalcFishInstanceTransform(instance, fishInstanceTransforms[int(i)]);
-		fishInstances.push_back(instance);
+		fish.meshes[row].mesh = fishMesh;
+		CalcFishInstanceTransform(instance, fish.matrices[row]);
+		FishRenderer::setPhase(fish.matrices[row], FishPhase(int(i)));
+	}
+}
+
+// one school fish entity per boid, FishSchool writes their matrices
+void setSchoolEntities(int count)
+{
+	ActorWorld* world = ActorWorld::Instance();
+	world->destroyAll(SCHOOL_FISH);
+	for (int i = 0; i < count; ++i)
+	{
+		Entity entity = world->create(SCHOOL_FISH);
+		world->archetypeOf(entity).meshes[world->rowOf(entity)].mesh = fishMesh;
 	}
 }
 
@@ -326,6 +368,8 @@ void generateObjectBufferMesh() {
 	{
 		 staticModels.push_back(load_mesh(path.c_str(), false));
 	}
+	// the ground crabs walk on and the fish and the camera stay above
+	Seabed::Instance()->Init(staticModels);
 
 	const vector<pair<glm::vec3, glm::vec3>> CrabInitData = {
 		{{ -65, 8, 30}, {0, glm::radians(-64.8), 0}},
@@ -335,27 +379,41 @@ void generateObjectBufferMesh() {
 		{{ -84.4,7,24.7}, {0, glm::radians(119.f), 0}}
 	};
 
+	// each crab file is loaded once as a shared mesh, the crabs are entities that refer to it
+	ActorWorld* world = ActorWorld::Instance();
 	vector<string> CrabsPaths = GetAllModelsInPath(CRAB_FOLDER);
-	// load each model
-	for (int i = 0; i < CrabsPaths.size(); ++i)
+	vector<MeshHandle> crabMeshes;
+	for (size_t i = 0; i < CrabsPaths.size(); ++i)
 	{
-		Crab crab;
-		crab.model = load_mesh(CrabsPaths[i].c_str(), false);
-		for (const auto& vertex : crab.model.mVertices)
-		{
-			crab.translation += vertex;
-		}
-		crab.translation /= static_cast<float>(crab.model.mVertices.size());
-		crab.translation = CrabInitData[i].first;
-		crab.rotation = CrabInitData[i].second;
-		CrabModels.emplace_back(crab);
+		MeshHandle mesh = world->addMesh(load_mesh(CrabsPaths[i].c_str(), false));
+		crabMeshes.push_back(mesh);
+		Entity entity = world->create(CRAB_ACTOR);
+		Archetype& crabs = world->archetypeOf(entity);
+		size_t row = world->rowOf(entity);
+		crabs.transforms[row].position = CrabInitData[i].first;
+		crabs.transforms[row].rotation = CrabInitData[i].second;
+		crabs.velocities[row].linear = glm::vec3(5.0f, 0.f, 5.0f);
+		crabs.grounded[row].offset = CrabInitData[i].first.y - Seabed::Instance()->height(CrabInitData[i].first.x, CrabInitData[i].first.z);
+		crabs.meshes[row].mesh = mesh;
 	}
+	world->updateGrounding();
+	world->updateMatrices();
 
-	fishModel = load_mesh(FISH_MODEL, true);
+	// FishRenderer and SkinnedCrowd draw the fish from their archetype matrices
+	fishMesh = world->addMesh(load_mesh(FISH_MODEL, true), false);
+	const ModelData& fishModel = world->meshes[fishMesh].model;
 	InitializeFishInstances();
 
+	// skinned versions for the files that carry bones and clips
+	SkinnedCrowd::Instance()->loadFish(FISH_MODEL, fishModel.mTextureId);
+	for (size_t i = 0; i < crabMeshes.size(); ++i)
+	{
+		SkinnedCrowd::Instance()->loadCrab(crabMeshes[i], CrabsPaths[i].c_str(), world->meshes[crabMeshes[i]].model.mTextureId);
+	}
+
 	// Generate lava mesh
 	lavaModel = generateLavaPlane(lavaWidth, lavaWidth, 100, 100);
+	lavaTiles.build(lavaModel, 100, 100);
 	lavaModel.mTexturePath = LAVA_TEXTURE;
 	lavaModel.mTextureId = TextureManager::Instance()->LoadTexture(LAVA_TEXTURE);
 
@@ -379,7 +437,7 @@ void generateObjectBufferMesh() {
 
 		// Normals VBO
 		glBindBuffer(GL_ARRAY_BUFFER, model.mVBOs[1]);
-		glBufferData(GL_ARRAY_BUFFER, model.mPointCount * sizeof(glm::vec3), model.mNormals.data(), GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, model.mPointCount * sizeof(glm::vec3), model.mNormals.data(), type == Type::LAVA? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
 		glVertexAttribPointer(loc2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
 		glEnableVertexAttribArray(loc2);
 
@@ -391,24 +449,10 @@ void generateObjectBufferMesh() {
 
 		switch (type)
 		{
-		case Type::FISH: // Instance
-			glGenBuffers(1, &model.instanceVBO);
-			glBindBuffer(GL_ARRAY_BUFFER, model.instanceVBO);
-
-			// Allocate space for instance data (e.g., model matrices)
-			glBufferData(GL_ARRAY_BUFFER, fishInstanceTransforms.size() * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
-
-			// Set up instanced matrix attribute (mat4 occupies 4 attribute slots)
-			for (int i = 0; i < 4; i++) {
-				glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
-				glEnableVertexAttribArray(3 + i);
-				glVertexAttribDivisor(3 + i, 1); // Tell OpenGL this is per-instance data
-			}
-			break;
 		case Type::LAVA:
 			// EBO
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.mEBO);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, model.mIndices.size() * sizeof(unsigned int), model.mIndices.data(), GL_STATIC_DRAW);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, model.IndexCount() * model.IndexSize(), model.IndexData(), GL_STATIC_DRAW);
 			break;
 		default:
 			break;
@@ -417,7 +461,7 @@ void generateObjectBufferMesh() {
 		glBindVertexArray(0); 
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		for (int j = 0; j < model.mChildMeshes.size(); ++j)
+		for (size_t j = 0; j < model.mChildMeshes.size(); ++j)
 		{
 			SetUpModelBuffers(model.mChildMeshes[j], type);
 		}
@@ -429,13 +473,15 @@ void generateObjectBufferMesh() {
 		SetUpModelBuffers(model, Type::STATIC);
 	}
 
-	for (auto& crab : CrabModels)
+	for (MeshHandle mesh : crabMeshes)
 	{
-		SetUpModelBuffers(crab.model, Type::CRAB);
+		SetUpModelBuffers(world->meshes[mesh].model, Type::CRAB);
+		world->enableInstancing(mesh);
 	}
 
 	
-	SetUpModelBuffers(fishModel, Type::FISH);
+	// all fish parts in one instanced draw
+	FishRenderer::Instance()->Init(fishModel);
 	
 	SetUpModelBuffers(lavaModel, Type::LAVA);
 
@@ -464,7 +510,9 @@ void renderModels()
 	glUniformMatrix4fv(glGetUniformLocation(terrianShaderProgramID, "view"), 1, GL_FALSE, glm::value_ptr(view));
 	glUniform3f(glGetUniformLocation(terrianShaderProgramID, "viewPos"), cameraPosition.x, cameraPosition.y, cameraPosition.z);
 	glUniform3f(glGetUniformLocation(terrianShaderProgramID, "lightDirection"), lightDirection.x, lightDirection.y, lightDirection.z);
-	glUniform1f(glGetUniformLocation(terrianShaderProgramID, "time"), timeInSeconds);
+	glUniform1f(glGetUniformLocation(terrianShaderProgramID, "timeInSeconds"), timeInSeconds);
+	glUniform1i(glGetUniformLocation(terrianShaderProgramID, "lavaOnGPU"), lavaOnGPU && !LavaFlow::Instance()->enabled);
+	glUniform1i(glGetUniformLocation(terrianShaderProgramID, "lavaFlow"), LavaFlow::Instance()->enabled);
 
 
 	int matrix_loc = glGetUniformLocation(terrianShaderProgramID, "model");
@@ -482,7 +530,8 @@ void renderModels()
 		glUniform1i(glGetUniformLocation(terrianShaderProgramID, "type"), int(type));
 		if (type == Type::LAVA)
 		{
-			glDrawElements(GL_TRIANGLES, mesh.mIndices.size(), GL_UNSIGNED_INT, 0);
+			// only the tiles inside the view frustum
+			lavaTiles.draw(mesh);
 		}
 		else
 		{
@@ -493,43 +542,6 @@ void renderModels()
 		glBindTexture(GL_TEXTURE_2D, 0);
 	};
 
-	function<void(const ModelData&, const vector<glm::mat4>&)> UpdateAnimationInstances = [&](const ModelData& mesh, const vector<glm::mat4>& transforms)
-	{	
-		// bind texture
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, mesh.mTextureId);
-
-		// bind VAO
-		glBindVertexArray(mesh.mVao);
-
-		glUniform1i(glGetUniformLocation(terrianShaderProgramID, "texture1"), 0);
-
-		// bind isInstanced flag
-		glUniform1i(glGetUniformLocation(terrianShaderProgramID, "type"), int(Type::FISH));
-
-		// Update instance mesh
-		if (!fishInstances.empty() && mesh.instanceVBO != 0)
-		{
-			// Bind the instance VBO
-			glBindBuffer(GL_ARRAY_BUFFER, mesh.instanceVBO);
-
-			// Map the buffer and copy new instance data
-			glm::mat4* mappedBuffer = static_cast<glm::mat4*>(
-				glMapBufferRange(GL_ARRAY_BUFFER, 0, transforms.size() * sizeof(glm::mat4),
-					GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
-
-			// Copy the updated model matrices to the buffer
-			std::memcpy(mappedBuffer, transforms.data(), transforms.size() * sizeof(glm::mat4));
-
-			// Unmap the buffer
-			glUnmapBuffer(GL_ARRAY_BUFFER);
-			glDrawArraysInstanced(GL_TRIANGLES, 0, static_cast<GLsizei>(fishModel.mPointCount), transforms.size());
-		}
-
-		// Cleanup
-		glBindVertexArray(0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-	};
 	glm::mat4 modelMat(1.0f);
 
 	// Draw static models
@@ -538,62 +550,54 @@ void renderModels()
 		UpdateShaderVariables(staticModel, modelMat, Type::STATIC);
 	}
 
-	// Draw crabs
-	for (const auto& crab : CrabModels)
+	// Draw crabs, one instanced draw per mesh, the skinned ones are drawn below
+	SkinnedCrowd* skinnedCrowd = SkinnedCrowd::Instance();
+	ActorWorld* world = ActorWorld::Instance();
+	world->gatherBatches();
+	for (MeshHandle mesh = 0; mesh < world->meshes.size(); ++mesh)
 	{
-		modelMat = crab.GetModelTransform();
-		UpdateShaderVariables(crab.model, modelMat, Type::CRAB);
+		if (world->meshes[mesh].batched && !skinnedCrowd->drawsMesh(mesh))
+		{
+			world->drawBatch(mesh, terrianShaderProgramID, persp_proj * view, Type::CRAB);
+		}
 	}
 
-	// Draw lava
+	// Draw lava, as one grid or as CDLOD nodes around the camera
 	modelMat = glm::mat4(1.0f);
 	modelMat = glm::translate(modelMat, lavaPosition);
-	UpdateShaderVariables(lavaModel, modelMat, Type::LAVA);
-
-
-	// Draw instanced fish animation 
-	// Calcualte the fish body rotation matrix
-	glm::mat4 rotateBodyMtx = glm::mat4(1.f);
-	rotateBodyMtx = glm::rotate(rotateBodyMtx, glm::radians(rotate_body), glm::vec3(0.0f, 1.0f, 0.0f));
-	vector<glm::mat4> TmpTransforms(FISHCOUNT, rotateBodyMtx);
-
-	// Calculate the transforms of all fish body instances
-	std::transform(fishInstanceTransforms.begin(), fishInstanceTransforms.end(), TmpTransforms.begin(),
-		[&](const glm::mat4& transform) { return transform * rotateBodyMtx; });
+	if (LavaLod::Instance()->enabled)
+	{
+		LavaLod::Instance()->update(cameraPosition - lavaPosition);
+		LavaLod::Instance()->render(terrianShaderProgramID, modelMat, lavaModel.mTextureId);
+	}
+	else
+	{
+		UpdateShaderVariables(lavaModel, modelMat, Type::LAVA);
+	}
 
-	// pass transforms to the shader
-	UpdateAnimationInstances(fishModel, TmpTransforms);
 
-	for (int i = 0; i < fishModel.mChildMeshes.size(); ++i)
+	// Draw all fish with one instanced draw, the shader sways the parts
+	bool fishOrbitsOnGPU = fishOnGPU && !FishSchool::Instance()->enabled;
+	bool skinnedFish = skinnedCrowd->enabled && skinnedCrowd->fish.loaded && !fishOrbitsOnGPU;
+	if (!skinnedFish)
 	{
-		//  Calcualte the child rotation matrix
-		auto& childMesh = fishModel.mChildMeshes[i];
-		glm::mat4 rotateChildMtx(1.0);
-		if (i == 0) // first child mesh is the head
-		{
-			rotateChildMtx = glm::rotate(rotateChildMtx, glm::radians(rotate_head), glm::vec3(0.0f, 1.0f, 0.0f));
-		}
-		else // second child mesh is the fin
+		if (!fishOrbitsOnGPU)
 		{
-			rotateChildMtx = glm::rotate(rotateChildMtx, glm::radians(rotate_fin), glm::vec3(0.0f, 1.0f, 0.0f));
+			FishRenderer::Instance()->uploadInstances(fishTransforms(), persp_proj * view);
 		}
-		
-		// Calculate the transforms of all child instances for the same part
-		std::transform(fishInstanceTransforms.begin(), fishInstanceTransforms.end(), TmpTransforms.begin(),
-			[&](const glm::mat4& transform) { return transform * rotateBodyMtx * fishModel.mChildMeshes[i].mLocalTransform * rotateChildMtx; });
-	
-		// pass transforms of child instances to the shader
-		UpdateAnimationInstances(childMesh, TmpTransforms);
+		FishRenderer::Instance()->render(terrianShaderProgramID, fishOrbitsOnGPU ? fishOrbits.size() : FishRenderer::Instance()->visibleCount, fishOrbitsOnGPU);
 	}
-}
-
-void display() {
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	// Background color to blue
-	glClearColor(0.004f, 0.361f, 0.588f, 0.8f);
+	// Skinned fish and crabs, animated for the instances in the view
+	if (skinnedCrowd->enabled)
+	{
+		skinnedCrowd->update(fishTransforms(), world->meshes, timeInSeconds, persp_proj * view, skinnedFish);
+		skinnedCrowd->render(persp_proj, view, cameraPosition, lightDirection, timeInSeconds);
+	}
+}
 
-	// update view matrix
+// view matrix from the camera position and its yaw and pitch
+void updateView() {
 	glm::vec3 forward(0.0);
 	forward.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
 	forward.y = sin(glm::radians(pitch));
@@ -601,9 +605,42 @@ void display() {
 	forward = glm::normalize(forward);
 	glm::vec3 cameraTarget = cameraPosition + forward;
 	view = glm::lookAt(cameraPosition, cameraTarget, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+void display() {
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// Background color to blue
+	glClearColor(0.004f, 0.361f, 0.588f, 0.8f);
+
+	// update view matrix, the mouse may have turned the camera since updateScene
+	updateView();
 
 	renderModels();
-	ParticleSystem::Instance()->renderParticles();
+
+	// fish culled by the frustum in the window title, once a second
+	static float lastCullReport = 0.0f;
+	if (timeInSeconds - lastCullReport >= 1.0f)
+	{
+		lastCullReport = timeInSeconds;
+		FishRenderer* fishRenderer = FishRenderer::Instance();
+		size_t drawn = fishRenderer->visibleCount, culled = fishRenderer->culledCount;
+		if (SkinnedCrowd::Instance()->enabled && SkinnedCrowd::Instance()->drawsFish)
+		{
+			drawn = SkinnedCrowd::Instance()->fish.visibleCount;
+			culled = fishTransforms().size() - drawn;
+		}
+		string title = "Underwater volcano - fish drawn " + to_string(drawn) + ", culled " + to_string(culled);
+		glutSetWindowTitle(title.c_str());
+	}
+	if (SmokeVolume::Instance()->enabled)
+	{
+		SmokeVolume::Instance()->render();
+	}
+	else
+	{
+		ParticleSystem::Instance()->renderParticles();
+	}
 
 	glutSwapBuffers();
 }
@@ -626,85 +663,86 @@ void updateIllumination()
 }
 
 float currentAngle = 0.0f;
-void updateAnimation()
+// deltaTime is the frame time of the clock behind timeInSeconds, which the shader orbits use
+void updateAnimation(float deltaTime)
 {
-	// Fin and head of a fish rotate in a sinusoidal pattern
-	rotate_fin = 4.f * sin(timeInSeconds*2.5f);
-	rotate_body = 2.f * sin(timeInSeconds*2.5f + glm::radians(45.0f));
-	rotate_head = 4.f * sin(timeInSeconds*2.5f + glm::radians(90.0f));
-
-	const float deltaTime = 0.016f;
-	for (int i = 0; i < FISHCOUNT; ++i) {
-		auto& fish = fishInstances[i];
+	if (FishSchool::Instance()->enabled)
+	{
+		FishSchool::Instance()->update(deltaTime, fishTransforms());
+		return;
+	}
+	if (fishOnGPU)
+	{
+		return; // the vertex shader places the fish
+	}
+	Archetype& circling = ActorWorld::Instance()->archetype(CIRCLING_FISH);
+	for (size_t i = 0; i < circling.size(); ++i) {
+		auto& fish = circling.orbits[i];
 		// Update angle based on speed
 		fish.angle += fish.speed * deltaTime;
 		if (fish.angle > glm::two_pi<float>()) {
 			fish.angle -= glm::two_pi<float>();
 		}
-		CalcFishInstanceTransform(fish, fishInstanceTransforms[i]);
+		CalcFishInstanceTransform(fish, circling.matrices[i]);
+		FishRenderer::setPhase(circling.matrices[i], FishPhase(int(i)));
 	}
 
 }
 
-float NormalizeAngle(float angle) {
-	while (angle > glm::pi<float>()) angle -= glm::two_pi<float>();
-	while (angle < -glm::pi<float>()) angle += glm::two_pi<float>();
-	return angle;
-}
-
+// crabs that were clicked run away from the camera
 void updateCrabMovement() {
 	const float deltaTime = 0.016f;
-
-	for (auto& crab : CrabModels) 
-	{
-		if (crab.runAway) 
-		{
-			glm::vec3 direction = glm::normalize(crab.CurrentPosition() - cameraPosition);
-			crab.translation += direction * crab.velocity * deltaTime;
-
-			/// Update crab's rotation to "face away" from the camera
-			float targetYaw = NormalizeAngle((atan2(direction.x, direction.z))); // Yaw angle for local Y-axis rotation
-
-			// Smoothly interpolate rotation to target
-			if(crab.runAwayTime  >= (RUNAWAYTIME / 2.f))
-				crab.rotation.y = crab.rotation.y + NormalizeAngle(targetYaw - crab.rotation.y) * (RUNAWAYTIME - crab.runAwayTime) / RUNAWAYTIME * 2.f;
-
-			// Stop movement after a certain distance
-			cout << "Crab run away time: " << crab.runAwayTime << endl;
-			if (crab.runAwayTime <= 0.f) {
-				crab.runAway = false; // Stop the crab
-			}
-			crab.runAwayTime -= deltaTime;
-		}
-	}
+	ActorWorld::Instance()->updateRunAway(deltaTime, cameraPosition);
+	ActorCollision::Instance()->update(*ActorWorld::Instance(), deltaTime);
+	ActorWorld::Instance()->updateGrounding();
+	ActorWorld::Instance()->updateMatrices();
 }
 
 void updateScene() {
 
 	static auto lastTime = std::chrono::high_resolution_clock::now();
 	auto currentTime = std::chrono::high_resolution_clock::now();
+	float deltaTime = std::chrono::duration<float>(currentTime - lastTime).count();
+	lastTime = currentTime;
 
 	// Elapsed time in seconds
 	timeInSeconds = (currentTime - startTime).count() * 1e-9;
 
+	// Update the camera position based on user input, first so that the culling below uses this frame's view
+	keyControl::updateCameraPosition();
+	updateView();
+
 	// update sun light position and direction
 	updateIllumination();
 
-	// update fish animation
-	updateAnimation();
+	// update fish animation, at lower rates for the fish that are small on screen
+	AnimationLod::Instance()->beginFrame(cameraPosition, persp_proj, height);
+	updateAnimation(deltaTime);
 
 	// update crab movement
 	updateCrabMovement();
 
 	// update smoke particles
 	ParticleSystem::Instance()->updateParticles(0.01, 3);
+	if (SmokeVolume::Instance()->enabled)
+	{
+		SmokeVolume::Instance()->update();
+	}
 
-	// update lava
-	updatePlaneVerticesWithHeight(lavaModel, 100, 100, timeInSeconds);
-
-    
-	// Update the camera position based on user input
-	keyControl::updateCameraPosition();
+	// update the visible lava tiles, unless the vertex shader displaces them
+	lavaTiles.cull(persp_proj * view, lavaPosition);
+	if (LavaFlow::Instance()->enabled)
+	{
+		LavaFlow::Instance()->update(deltaTime);
+		LavaFlow::Instance()->writeMesh(lavaModel, lavaHeightField);
+	}
+	else if (!lavaOnGPU && !LavaLod::Instance()->enabled)
+	{
+		if (LavaWorker::Instance()->enabled)
+			LavaWorker::Instance()->update(lavaModel, timeInSeconds, cameraPosition - lavaPosition);
+		else
+			lavaTiles.update(lavaModel, timeInSeconds, cameraPosition - lavaPosition);
+	}
 
     glutPostRedisplay();
 }
@@ -716,12 +754,129 @@ void init()
 	glDisable(GL_BLEND);
 	CompileTerrianShader();
 	generateObjectBufferMesh();
+	ScenePicker::Instance()->Init(staticModels, *ActorWorld::Instance());
 	ParticleSystem::Instance()->Init();
+	SmokeVolume::Instance()->Init();
+	LavaLod::Instance()->Init();
+	LavaWorker::Instance()->Init(lavaModel);
+	LavaFlow::Instance()->Init(lavaModel);
+	SkinnedCrowd::Instance()->Init();
+}
+
+
+// move the circling fish in the vertex shader or on the CPU, they stay where they are
+void setFishOnGPU(bool value)
+{
+	fishOnGPU = value;
+	Archetype& circling = ActorWorld::Instance()->archetype(CIRCLING_FISH);
+	fishOrbits.resize(circling.size());
+	for (size_t i = 0; i < circling.size(); ++i)
+	{
+		FishInstance& fish = circling.orbits[i];
+		if (fishOnGPU)
+		{
+			// the shader angle is angle0 + speed * time
+			float angle0 = fmod(fish.angle - fish.speed * timeInSeconds, glm::two_pi<float>());
+			fishOrbits[i] = glm::vec4(angle0, fish.speed, fish.radius, fish.y);
+		}
+		else
+		{
+			fish.angle = fmod(fishOrbits[i].x + fish.speed * timeInSeconds, glm::two_pi<float>());
+		}
+	}
+
+	if (fishOnGPU)
+	{
+		FishRenderer::Instance()->uploadOrbits(fishOrbits);
+	}
+	cout << "Circling fish: " << (fishOnGPU ? "GPU" : "CPU") << endl;
+}
+
+// keys that switch the optional simulation and render paths at runtime
+void keypress(unsigned char key, int x, int y)
+{
+	ParticleSystem* particleSystem = ParticleSystem::Instance();
+	switch (key)
+	{
+	case '1': // smoke simulated on the CPU, in transform feedback buffers or analytically in the vertex shader
+		particleSystem->setBackend(ParticleBackend((particleSystem->backend + 1) % 3));
+		break;
+	case '2': // smoke as billboards or as a raymarched density volume
+		SmokeVolume::Instance()->setEnabled(!SmokeVolume::Instance()->enabled);
+		break;
+	case '3': // billboards at full, half or quarter resolution
+		OffscreenParticlePass::Instance()->setDivisor(OffscreenParticlePass::Instance()->divisor == 4 ? 1 : OffscreenParticlePass::Instance()->divisor * 2);
+		break;
+	case '4': // unsorted, sorted or weighted blended order-independent transparency
+		particleSystem->setTransparency(TransparencyMode((particleSystem->transparency + 1) % 3));
+		break;
+	case '5': // lava heights on the CPU or in the vertex shader
+		lavaOnGPU = !lavaOnGPU;
+		cout << "Lava displacement: " << (lavaOnGPU ? "GPU" : "CPU") << endl;
+		break;
+	case '6': // lava as a single grid or as a CDLOD field covering the whole map
+		LavaLod::Instance()->setEnabled(!LavaLod::Instance()->enabled);
+		break;
+	case '7': // lava heights for the next frame on a worker thread or on the main thread
+		LavaWorker::Instance()->setEnabled(!LavaWorker::Instance()->enabled);
+		break;
+	case '8': // lava as waves or as a shallow water flow from the crater
+		LavaFlow::Instance()->setEnabled(!LavaFlow::Instance()->enabled);
+		break;
+	case '0': // circling fish moved on the CPU or in the vertex shader
+		setFishOnGPU(!fishOnGPU);
+		break;
+	case '9': // the circling fish or a boids school of 1k, 10k or 50k fish
+	{
+		static const int schoolSizes[] = { 0, 1000, 10000, 50000 };
+		static int schoolSize = 0;
+		schoolSize = (schoolSize + 1) % 4;
+		FishSchool::Instance()->setCount(schoolSizes[schoolSize]);
+		setSchoolEntities(schoolSizes[schoolSize]);
+		if (FishSchool::Instance()->enabled)
+		{
+			FishSchool::Instance()->writeTransforms(fishTransforms());
+		}
+		break;
+	}
+	case 'j': // fish sway and clips evaluated every frame or played from baked vertex animation textures
+		FishRenderer::Instance()->vertexAnimation = !FishRenderer::Instance()->vertexAnimation;
+		SkinnedCrowd::Instance()->vertexAnimation = FishRenderer::Instance()->vertexAnimation;
+		cout << "Fish and crab animation: " << (FishRenderer::Instance()->vertexAnimation ? "vertex animation textures" : "evaluated") << endl;
+		break;
+	case 'l': // every fish animated at full rate or by its size on screen
+		AnimationLod::Instance()->setEnabled(!AnimationLod::Instance()->enabled);
+		break;
+	case 'k': // fish and crabs as rigid meshes or skinned with their animation clips
+		SkinnedCrowd::Instance()->setEnabled(!SkinnedCrowd::Instance()->enabled);
+		break;
+	default:
+		break;
+	}
+	keyControl::keypress(key, x, y);
 }
 
 
 int main(int argc, char** argv) {
 
+	// --benchmark times the CPU kernels and exits without opening a window
+	for (int i = 1; i < argc; ++i)
+	{
+		if (string(argv[i]) == "--benchmark")
+		{
+			benchmarkLavaKernel();
+			benchmarkLavaFlow();
+			benchmarkFishSchool();
+			benchmarkInstanceTransforms();
+			benchmarkSkinning();
+			benchmarkClipCompression();
+			benchmarkActorWorld();
+			benchmarkPicking();
+			benchmarkActorCollision();
+			return 0;
+		}
+	}
+
 	// Set up the window
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
@@ -732,7 +887,7 @@ int main(int argc, char** argv) {
 	glutDisplayFunc(display);
 	glutIdleFunc(updateScene);
 
-	glutKeyboardFunc(keyControl::keypress);
+	glutKeyboardFunc(keypress);
 	glutKeyboardUpFunc(keyControl::keyRelease);
 	glutSpecialFunc(keyControl::specialKeypress);
 	glutSpecialUpFunc(keyControl::specialKeyRelease);
@@ -749,6 +904,8 @@ int main(int argc, char** argv) {
 	}
 	// Set up your objects and shaders
 	init();
+	// glutMainLoop never returns, the lava worker is joined when the program exits
+	atexit([] { LavaWorker::Instance()->Shutdown(); });
 	// Begin infinite event loop
 	glutMainLoop();
 	return 0;